@@ -0,0 +1,91 @@
+// Allocations.cpp : Replaces the global allocation functions to count heap
+// allocations. Kept out of the parsing translation unit so the compiler
+// never inlines these malloc/free based replacements next to a new
+// expression it would pair with the library's own delete.
+
+#include "Allocations.h"
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+using namespace std;
+
+static atomic<size_t> allocationCount(0u);
+
+static void* Allocate(size_t size)
+{
+    allocationCount++;
+    auto p = malloc(size == 0u ? 1u : size);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+auto GetAllocationCount() -> size_t
+{
+    return allocationCount.load();
+}
+
+void* operator new(size_t size)
+{
+    return Allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return Allocate(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    try
+    {
+        return Allocate(size);
+    }
+    catch (const bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, const nothrow_t&) noexcept
+{
+    try
+    {
+        return Allocate(size);
+    }
+    catch (const bad_alloc&)
+    {
+        return nullptr;
+    }
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) noexcept
+{
+    free(p);
+}
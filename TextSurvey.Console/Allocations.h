@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stddef.h>
+
+// Calls to the global operator new and new[] so far, across all threads.
+auto GetAllocationCount() -> size_t;
@@ -1,11 +1,14 @@
 #pragma once
 
+#if defined(_WIN32)
 #include <SDKDDKVer.h>
-#include <stdio.h>
 #include <tchar.h>
+#endif
+#include <stdio.h>
 #include <iostream>
 
 #include <time.h>
+#include <chrono>
 #include <stdint.h>
 using namespace std;
 
@@ -1,158 +1,939 @@
-// TextSurvey.Console.cpp : Defines the entry point for the console application.
+// TextSurvey.Console.cpp : Parses files with one of the built-in grammars and
+// reports throughput, memory use and parse errors.
 //
+//     TextSurvey.Console [options] [file...]      (no file or - reads stdin)
+//
+//     -g, --grammar json|ndjson|csv|tlisp      default json
+//     -s, --stream ascii|utf8|mmap|streaming   default ascii; utf8 only
+//                         changes how tlisp reads, the other grammars
+//                         always read bytes
+//     -t, --threads N     workers for ndjson and csv, 0 = one per core
+//     -r, --repeat N      measured runs, default 1
+//     -w, --warmup N      unmeasured runs first, default 0
+//     -d, --delimiter C   csv field delimiter, "tab" for TSV
 
 #include "Common.h"
+#include "Allocations.h"
 #include "../TextSurvey/TextSurvey.h"
-#include "../TextSurvey/Json.h"
-//using namespace TextSurvey;
-//
-//
-//namespace TLisp
-//{
-//
-//    struct Node {
-//        enum {
-//            Invalid,
-//            Bool,
-//            Int32,
-//            Name,
-//            List
-//        } Type;
-//        union {
-//            bool BoolValue;   
-//            uint32_t Int32Value;
-//            string* NameValue;
-//            vector<Node*>* ListValue;
-//        } Value;
-//
-//        ~Node() {
-//            if (Type == Name && Value.NameValue != nullptr)
-//                delete Value.NameValue;
-//            if (Type != List || Value.ListValue == nullptr)
-//                return;
-//            for (auto p = Value.ListValue->begin(); p < Value.ListValue->end(); p++)
-//                delete *p;
-//            delete Value.ListValue;
-//        }
-//
-//        static auto Create(bool v) -> Node* {
-//            Node* n = new Node;
-//            n->Type = Bool;
-//            n->Value.BoolValue = v;
-//            return n;
-//        }
-//
-//        static auto Create(uint32_t v) -> Node* {
-//            Node* n = new Node;
-//            n->Type = Int32;
-//            n->Value.Int32Value = v;
-//            return n;
-//        }
-//
-//        static auto Create(vector<char> v) -> Node* {
-//            Node* n = new Node;
-//            n->Type = Name;
-//            n->Value.NameValue = new string(v.begin(), v.end());
-//            return n;
-//        }
-//
-//        static auto Create(vector<Node*> v) -> Node* {
-//            Node* n = new Node;
-//            n->Type = List;
-//            n->Value.ListValue = new vector<Node*>(v);
-//            return n;
-//        }
-//    };
-//
-//    
-//    static function<Result<Ignore>(State*)> WhiteSpaceParser = pSkipMany<char>(pChar(" \t\r\n"));  
-//    
-//    typedef function<Result<Node*>(State*)> NodeParserType;
-//
-//    static NodeParserType BoolParser = 
-//        pChoice<Node*>(
-//            pMap<string, Node*>(
-//                pString("true"), 
-//                [] (string s) { return Node::Create(true); }), 
-//            pMap<string, Node*>(
-//                pString("false"), 
-//                [] (string s) { return Node::Create(false); })); 
-//
-//    static NodeParserType Int32Parser = 
-//        pMap<uint32_t, Node*>(
-//            pUIntBase10<uint32_t>(), 
-//            [] (uint32_t v) { return Node::Create(v); });
-//    
-//    static const Range<char> nameRanges[2] = { { 'a', 'z' }, { 'A', 'Z' } };
-//    static NodeParserType NameParser = 
-//        pMap<vector<char>, Node*>(
-//            pMany<char, 1>(pChar(nameRanges, 2)), 
-//            [] (vector<char> v) { return Node::Create(v); });
-//
-//    auto GetListParser() -> NodeParserType;
-//
-//    auto GetWrappedListParser(State* s) -> Result<Node*> {
-//        return GetListParser()(s);
-//    }
-//
-//    static const NodeParserType nodeParsers[4] = { 
-//        BoolParser, 
-//        Int32Parser, 
-//        NameParser, 
-//        GetWrappedListParser 
-//    };
-//
-//    static NodeParserType NodeParser = pChoice(nodeParsers, 4);
-//
-//    auto GetListParser() -> NodeParserType
-//    {
-//        static NodeParserType ListParser = 
-//            pMap<vector<Node*>, Node*>(
-//                pBetween(pChar<'('>(), pManySeparated(NodeParser, WhiteSpaceParser), pChar<')'>()),
-//                [] (vector<Node*> e) { return Node::Create(e); }
-//            );
-//
-//        return ListParser;
-//    }    
-//
-//
-//    auto ParseText(string text) -> Node* {
-//        Result<Node*> r = RunParser<Node*>(text, NodeParser);
-//        if (r.IsFailure())
-//            return nullptr;
-//        return r.Value;
-//    }
-//}
+#include "../TextSurvey/JsonParser.h"
+#include "../TextSurvey/Csv.h"
+#include "../TextSurvey/ParseCache.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace TextSurvey;
+
+namespace TLisp
+{
+    inline bool IsSpace(uchar c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    inline bool IsAtomChar(uchar c)
+    {
+        return c > ' ' && c != '(' && c != ')';
+    }
+
+    auto Space() -> ParserType(ArenaVector<uchar>, unit)
+    {
+        return ManyInArena(Satisfy<unit>(IsSpace));
+    }
+
+    // An atom or a parenthesised list of forms; yields the number of atoms.
+    auto Form() -> ParserType(uint, unit)
+    {
+        auto form = make_shared<ParserType(uint, unit)>();
+        weak_ptr<ParserType(uint, unit)> self(form);
+        ParserType(uint, unit) recurse = [self] (State<unit> state) -> Result<uint>
+        {
+            return (*self.lock())(state);
+        };
+        auto separator = ManyInArena(Satisfy<unit>(IsSpace), OneOrMore);
+        auto atom = Bind<ArenaVector<uchar>, uint, unit>(
+            Expect("atom", ManyInArena(Satisfy<unit>(IsAtomChar), OneOrMore)),
+            [] (ArenaVector<uchar>) { return Return<uint, unit>(1u); });
+        auto items = Between(
+            Sequence(Match<unit>((uchar)'('), Space()),
+            SplitInArena(recurse, separator),
+            Sequence(Space(), Match<unit>((uchar)')')));
+        auto list = Bind<ArenaVector<uint>, uint, unit>(items, [] (ArenaVector<uint> counts)
+        {
+            auto total = 0u;
+            for (auto count : counts)
+                total += count;
+            return Return<uint, unit>(total);
+        });
+        *form = Choice(list, atom);
+        return [form] (State<unit> state) -> Result<uint>
+        {
+            return (*form)(state);
+        };
+    }
+
+    auto Document() -> ParserType(ArenaVector<uint>, unit)
+    {
+        return Between(Space(), SplitInArena(Form(), ManyInArena(Satisfy<unit>(IsSpace), OneOrMore)), Space());
+    }
+
+    // One form at a time for PushParser; None once only whitespace is left.
+    auto Message() -> ParserType(Option<uint>, unit)
+    {
+        typedef tuple<ArenaVector<uchar>, Option<uint>> Parts;
+        return Bind<Parts, Option<uint>, unit>(
+            Sequence(Space(), Optional(Form())),
+            [] (Parts parts) { return Return<Option<uint>, unit>(get<1>(parts)); });
+    }
+}
+
+enum struct StreamKind
+{
+    Ascii,
+    Utf8,
+    Mmap,
+    Streaming
+};
+
+struct Options
+{
+    string Grammar;
+    StreamKind Stream;
+    uint Threads;
+    uint Repeat;
+    uint Warmup;
+    uint8 Delimiter;
+    // Bytes of JSON results to keep between parses; 0 disables the cache.
+    size_t CacheBytes;
+    vector<string> Paths;
+
+    Options() :
+        Grammar("json"), Stream(StreamKind::Ascii), Threads(1u), Repeat(1u), Warmup(0u), Delimiter(','), CacheBytes(0u)
+    {
+
+    }
+};
+
+struct Outcome
+{
+    uint64_t Records;
+    bool Failed;
+    uint ErrorOffset;
+    string Expected;
+
+    Outcome() :
+        Records(0u), Failed(false), ErrorOffset(0u)
+    {
+
+    }
+
+    void Fail(uint offset, const string& expected = string())
+    {
+        if (Failed)
+            return;
+        Failed = true;
+        ErrorOffset = offset;
+        Expected = expected;
+    }
+};
+
+// The bytes of one input, read into memory or mapped.
+class Input
+{
+private:
+
+    vector<uint8> _buffer;
+    const uint8* _data;
+    uint _length;
+    void* _mapping;
+
+    Input(const Input&);
+    Input& operator=(const Input&);
+
+public:
+
+    Input() :
+        _data(nullptr), _length(0u), _mapping(nullptr)
+    {
+
+    }
+
+    ~Input()
+    {
+#if !defined(_WIN32)
+        if (_mapping != nullptr)
+            munmap(_mapping, _length);
+#endif
+    }
+
+    bool Read(FILE* file)
+    {
+        vector<uint8> chunk(1u << 16);
+        size_t n;
+        while ((n = fread(chunk.data(), 1u, chunk.size(), file)) > 0u)
+        {
+            if (_buffer.size() + n > (size_t)~0u)
+                return false;
+            _buffer.insert(_buffer.end(), chunk.begin(), chunk.begin() + n);
+        }
+        _data = _buffer.data();
+        _length = (uint)_buffer.size();
+        return ferror(file) == 0;
+    }
+
+    // Maps the file when map is set; otherwise, and on Windows, reads it.
+    bool Load(const string& path, bool map)
+    {
+        if (path == "-")
+            return Read(stdin);
+#if !defined(_WIN32)
+        if (map)
+        {
+            auto fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat info;
+            auto ok = fstat(fd, &info) == 0;
+            // Offsets are 32-bit, so larger files cannot be parsed.
+            if (ok && (uint64_t)info.st_size > (uint64_t)~0u)
+                ok = false;
+            else if (ok && info.st_size > 0)
+            {
+                _mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ok = _mapping != MAP_FAILED;
+                if (!ok)
+                {
+                    _mapping = nullptr;
+                }
+                else
+                {
+                    _data = (const uint8*)_mapping;
+                    _length = (uint)info.st_size;
+                }
+            }
+            close(fd);
+            return ok;
+        }
+#endif
+        auto file = fopen(path.c_str(), "rb");
+        if (file == nullptr)
+            return false;
+        auto ok = Read(file);
+        fclose(file);
+        return ok;
+    }
+
+    inline const uint8* GetData() const
+    {
+        return _data;
+    }
+
+    inline uint GetLength() const
+    {
+        return _length;
+    }
+};
+
+auto PeakResidentKilobytes() -> size_t
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0u;
+    return counters.PeakWorkingSetSize / 1024u;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0u;
+#if defined(__APPLE__)
+    return (size_t)usage.ru_maxrss / 1024u;
+#else
+    return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+// A whole stream as one JSON document, so JSON lines can go through ParseBatch.
+// A rejected document notes where it stopped in state.Failures.
+auto JsonLine() -> Grammar<shared_ptr<const Json::JsonValue>, unit>
+{
+    return Grammar<shared_ptr<const Json::JsonValue>, unit>([] (State<unit> state) -> Result<shared_ptr<const Json::JsonValue>>
+    {
+        // Records repeat the same few keys, and Parse interns them once per
+        // worker thread.
+        auto& stream = state.Stream;
+        uint errorOffset;
+        auto value = Json::Parse(stream.GetData(), stream.GetLength(), &errorOffset);
+        if (value == nullptr)
+        {
+            if (state.Failures != nullptr)
+                state.Failures->Fail(errorOffset);
+            return Result<shared_ptr<const Json::JsonValue>>();
+        }
+        stream.Seek(stream.GetEnd(), stream.GetEnd());
+        return Result<shared_ptr<const Json::JsonValue>>(shared_ptr<const Json::JsonValue>(value));
+    });
+}
+
+// Roughly the heap bytes a tree holds, not counting its interned keys. The
+// cache budget does not cover those: they live in the key table of the
+// thread that parsed the tree, shared with every tree parsed there and
+// capped at Json::Parsing::MaxSharedKeys keys or MaxSharedKeyBytes bytes. A
+// cached tree keeps its table alive after the thread moves on to a new one,
+// so the cache can hold one such table per table its entries came from.
+auto MeasureJson(const Json::JsonValue& value) -> size_t
+{
+    switch (value.GetType())
+    {
+    case Json::JsonValueType::Object:
+        {
+            auto& object = (const Json::JsonObject&)value;
+            auto bytes = sizeof(Json::JsonObject) + object.GetMembers().capacity() * sizeof(Json::JsonMember);
+            for (auto& member : object.GetMembers())
+                bytes += MeasureJson(*member.Value);
+            return bytes;
+        }
+    case Json::JsonValueType::Array:
+        {
+            auto& array = (const Json::JsonArray&)value;
+            auto bytes = sizeof(Json::JsonArray) + array.Elements.capacity() * sizeof(unique_ptr<Json::JsonValue>);
+            for (auto& element : array.Elements)
+                bytes += MeasureJson(*element);
+            return bytes;
+        }
+    case Json::JsonValueType::String:
+        return sizeof(Json::JsonString) + ((const Json::JsonString&)value).Value.capacity();
+    case Json::JsonValueType::Number:
+        return sizeof(Json::JsonNumber);
+    case Json::JsonValueType::Boolean:
+        return sizeof(Json::JsonBoolean);
+    default:
+        return sizeof(Json::JsonNull);
+    }
+}
+
+// Cached trees are shared between callers and threads, so they are const:
+// adding a member would intern its key in another thread's table.
+typedef ParseCache<shared_ptr<const Json::JsonValue>, unit> JsonCache;
+
+// Shared by JSON documents and lines, so an input seen as either is a hit.
+auto GetJsonCache() -> JsonCache&
+{
+    static JsonCache cache(0u, [] (const shared_ptr<const Json::JsonValue>& value, uint)
+    {
+        return sizeof(value) + MeasureJson(*value);
+    });
+    return cache;
+}
+
+auto JsonGrammar() -> const Grammar<shared_ptr<const Json::JsonValue>, unit>&
+{
+    static const Grammar<shared_ptr<const Json::JsonValue>, unit> grammar(JsonLine());
+    return grammar;
+}
+
+// JsonGrammar through the cache, so cached lines still go through ParseBatch.
+auto CachedJsonGrammar() -> const Grammar<shared_ptr<const Json::JsonValue>, unit>&
+{
+    static const Grammar<shared_ptr<const Json::JsonValue>, unit> grammar([] (State<unit> state) -> Result<shared_ptr<const Json::JsonValue>>
+    {
+        auto& stream = state.Stream;
+        auto value = GetJsonCache().Parse(JsonGrammar(), stream.GetData(), stream.GetLength(), state.Failures);
+        if (value == nullptr)
+            return Result<shared_ptr<const Json::JsonValue>>();
+        stream.Seek(stream.GetEnd(), stream.GetEnd());
+        return Result<shared_ptr<const Json::JsonValue>>(*value);
+    });
+    return grammar;
+}
+
+// Parses one JSON document, through the cache when it is enabled.
+auto ParseJsonValue(const uint8* data, uint length, const Options& options, uint& errorOffset) -> bool
+{
+    if (options.CacheBytes != 0u)
+    {
+        FailureTracker failures;
+        if (GetJsonCache().Parse(JsonGrammar(), data, length, &failures) != nullptr)
+            return true;
+        errorOffset = failures.GetOffset();
+        return false;
+    }
+    unique_ptr<Json::JsonValue> value(Json::Parse(data, length, &errorOffset));
+    return value != nullptr;
+}
 
-void MeasureTime(size_t iterations, function<void(void)> f)
+void ParseJson(const uint8* data, uint length, const Options& options, Outcome& outcome)
 {
-    clock_t ct;
-    ct = clock();
-    for (size_t i = 0; i < iterations; i++)
-        f();
-    ct = clock() - ct;
-    float ctf = (float)ct;
-    float ctfs = ctf / (float)CLOCKS_PER_SEC;
-    ctfs *= 1000;
-    ctfs /= iterations;
-    cout << ctfs << "\n";
+    uint errorOffset;
+    if (ParseJsonValue(data, length, options, errorOffset))
+        outcome.Records++;
+    else
+        outcome.Fail(errorOffset);
 }
 
-int _tmain(int argc, _TCHAR* argv[])
+// Parses the lines of data; base is the offset of data in the whole input.
+void ParseNdjson(const uint8* data, uint length, uint base, const Options& options, Outcome& outcome)
+{
+    auto& grammar = options.CacheBytes != 0u ? CachedJsonGrammar() : JsonGrammar();
+    vector<TextInput> lines;
+    vector<uint> starts;
+    auto start = 0u;
+    auto addLine = [&] (uint end)
+    {
+        auto lineEnd = end > start && data[end - 1u] == '\r' ? end - 1u : end;
+        if (lineEnd > start)
+        {
+            lines.push_back(TextInput(data + start, lineEnd - start));
+            starts.push_back(start);
+        }
+        start = end + 1u;
+    };
+    Simd::FindEach(data, 0u, length, '\n', addLine);
+    if (start < length)
+        addLine(length);
+    vector<FailureTracker> failures(lines.size());
+    auto results = ParseBatch(grammar, lines, options.Threads, (const unit*)nullptr, nullptr, failures.data());
+    for (auto i = 0u; i < results.size(); i++)
+    {
+        if (results[i].Code == ResultCode::Success)
+        {
+            outcome.Records++;
+            continue;
+        }
+        outcome.Fail(base + starts[i] + failures[i].GetOffset());
+    }
+}
+
+void ParseCsv(const uint8* data, uint length, uint base, const Options& options, Outcome& outcome)
+{
+    Csv::CsvTable table;
+    if (!Csv::ReadAll(data, length, table, Csv::CsvOptions(options.Delimiter), options.Threads))
+        outcome.Fail(base + table.ErrorOffset);
+    outcome.Records += table.GetRowCount();
+}
+
+template<typename TStream>
+void ParseTLisp(const uint8* data, uint length, Arena& memory, Outcome& outcome)
+{
+    static const Grammar<ArenaVector<uint>, unit> grammar(TLisp::Document());
+    TStream stream(data, length);
+    FailureTracker failures;
+    State<unit> state(stream, nullptr, nullptr, &memory, &failures);
+    auto result = grammar(state);
+    if (result.Code == ResultCode::Success && stream.GetOffset() == length)
+        outcome.Records += result.Value.size();
+    else
+        outcome.Fail(failures.GetOffset(), failures.DescribeExpected());
+    result = Result<ArenaVector<uint>>();
+    memory.Reset();
+}
+
+void ParseBuffered(const Options& options, const uint8* data, uint length, Outcome& outcome)
+{
+    static Arena memory;
+    if (options.Grammar == "json")
+        ParseJson(data, length, options, outcome);
+    else if (options.Grammar == "ndjson")
+        ParseNdjson(data, length, 0u, options, outcome);
+    else if (options.Grammar == "csv")
+        ParseCsv(data, length, 0u, options, outcome);
+    else if (options.Stream == StreamKind::Utf8)
+        ParseTLisp<Utf8TextStream>(data, length, memory, outcome);
+    else
+        ParseTLisp<AsciiTextStream>(data, length, memory, outcome);
+}
+
+// Finds record breaks in a buffer that grows at the end and loses complete
+// records at the start, scanning each byte once. For CSV only line breaks
+// outside quotes count.
+class RecordScanner
+{
+private:
+
+    bool _csv;
+    bool _quoted;
+    uint _scanned;
+    uint _end;
+
+public:
+
+    RecordScanner(bool csv) :
+        _csv(csv), _quoted(false), _scanned(0u), _end(0u)
+    {
+
+    }
+
+    // Offset just past the last record break in data.
+    auto Scan(const uint8* data, uint length) -> uint
+    {
+        for (auto i = _scanned; i < length; i++)
+        {
+            if (_csv && data[i] == '"')
+                _quoted = !_quoted;
+            else if (data[i] == '\n' && !_quoted)
+                _end = i + 1u;
+        }
+        _scanned = length;
+        return _end;
+    }
+
+    // The caller dropped the first count bytes of its buffer.
+    void Consume(uint count)
+    {
+        _scanned -= count;
+        _end -= count;
+    }
+};
+
+// Splits a JSON document whose top level is an array or an object into its
+// elements or members as the bytes arrive, so each can be parsed once it is
+// complete and only the unfinished one stays buffered. Brackets inside
+// strings are skipped; everything else is left to the parser, which sees
+// each element as a document and each member wrapped in braces.
+class JsonSplitter
+{
+private:
+
+    uint8 _open;
+    uint _depth;
+    bool _inString;
+    bool _escaped;
+    bool _closed;
+    uint _scanned;
+    uint _start;
+    uint _count;
+    vector<uint8> _member;
+
+    static inline bool IsSpace(uint8 c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    static auto IsBlank(const uint8* data, uint begin, uint end) -> bool
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            if (!IsSpace(data[i]))
+                return false;
+        }
+        return true;
+    }
+
+    auto Take(const uint8* data, uint end, bool last, const Options& options, uint& errorOffset) -> bool
+    {
+        auto start = _start;
+        _start = end + 1u;
+        if (IsBlank(data, start, end))
+        {
+            errorOffset = end;
+            return last && _count == 0u;
+        }
+        _count++;
+        if (_open == '[')
+        {
+            if (ParseJsonValue(data + start, end - start, options, errorOffset))
+                return true;
+            errorOffset += start;
+            return false;
+        }
+        _member.assign(1u, '{');
+        _member.insert(_member.end(), data + start, data + end);
+        _member.push_back('}');
+        if (ParseJsonValue(_member.data(), (uint)_member.size(), options, errorOffset))
+            return true;
+        errorOffset = start + min(errorOffset - min(errorOffset, 1u), end - start);
+        return false;
+    }
+
+public:
+
+    JsonSplitter() :
+        _open(0u), _depth(0u), _inString(false), _escaped(false), _closed(false), _scanned(0u), _start(0u), _count(0u)
+    {
+
+    }
+
+    // Whether the top level is a scalar, which is parsed once it is whole.
+    inline bool IsScalar() const
+    {
+        return _open == 1u;
+    }
+
+    inline bool IsClosed() const
+    {
+        return _closed;
+    }
+
+    // Parses the elements data completes. Returns false with errorOffset set
+    // once the document is malformed.
+    auto Scan(const uint8* data, uint length, const Options& options, uint& errorOffset) -> bool
+    {
+        for (auto i = _scanned; i < length; i++)
+        {
+            auto c = data[i];
+            if (_closed || _open == 0u)
+            {
+                if (IsSpace(c))
+                    continue;
+                if (_closed)
+                {
+                    errorOffset = i;
+                    return false;
+                }
+                _open = c == '[' || c == '{' ? c : 1u;
+                if (IsScalar())
+                    break;
+                _depth = 1u;
+                _start = i + 1u;
+            }
+            else if (_inString)
+            {
+                if (_escaped)
+                    _escaped = false;
+                else if (c == '\\')
+                    _escaped = true;
+                else if (c == '"')
+                    _inString = false;
+            }
+            else if (c == '"')
+            {
+                _inString = true;
+            }
+            else if (c == '[' || c == '{')
+            {
+                _depth++;
+            }
+            else if (c == ']' || c == '}')
+            {
+                if (--_depth > 0u)
+                    continue;
+                _closed = true;
+                if (c != (_open == '[' ? ']' : '}'))
+                {
+                    errorOffset = i;
+                    return false;
+                }
+                if (!Take(data, i, true, options, errorOffset))
+                    return false;
+            }
+            else if (c == ',' && _depth == 1u)
+            {
+                if (!Take(data, i, false, options, errorOffset))
+                    return false;
+            }
+        }
+        _scanned = IsScalar() ? 0u : length;
+        return true;
+    }
+
+    // Bytes at the start of the buffer no element needs any more.
+    inline uint GetConsumable() const
+    {
+        return IsScalar() ? 0u : min(_start, _scanned);
+    }
+
+    // The caller dropped the first count bytes of its buffer.
+    void Consume(uint count)
+    {
+        _scanned -= count;
+        _start -= count;
+    }
+};
+
+// Reads the input in chunks and parses records as soon as they are complete:
+// TLisp forms through PushParser, NDJSON lines and CSV rows in batches. A
+// JSON document is one record; the elements or members of a top-level array
+// or object are parsed one at a time as they complete, and any other
+// document once all of it has arrived.
+void ParseStreaming(const Options& options, FILE* file, uint64_t& bytes, Outcome& outcome)
 {
- /*   using namespace TLisp;*/
-    using namespace TextSurvey;
-    using namespace Json;
+    static const Grammar<Option<uint>, unit> message(TLisp::Message());
+    const uint chunkSize = 1u << 16;
+    vector<uint8> chunk(chunkSize);
+    vector<uint8> pending;
+    PushParser<Option<uint>, unit> forms(message);
+    auto base = 0u;
+    auto takeForms = [&] (FeedStatus status, bool final) -> bool
+    {
+        for (;;)
+        {
+            if (final && status == FeedStatus::NeedMore && base < bytes)
+                status = forms.Finish();
+            if (status != FeedStatus::Done)
+                break;
+            auto consumed = forms.GetConsumed();
+            if (!forms.GetResult().Value.IsSome())
+            {
+                if (final && base + consumed == bytes)
+                    return true;
+                outcome.Fail(base + consumed);
+                return false;
+            }
+            outcome.Records++;
+            base += consumed;
+            status = forms.Next();
+        }
+        if (status != FeedStatus::Error)
+            return true;
+        outcome.Fail(base);
+        return false;
+    };
 
-    //auto s = State<unit>(AsciiTextStream("true"));
-    //auto p = Match<unit>("true");
+    auto isTLisp = options.Grammar == "tlisp";
+    auto isJson = options.Grammar == "json";
+    RecordScanner records(options.Grammar == "csv");
+    JsonSplitter document;
+    size_t n;
+    while ((n = fread(chunk.data(), 1u, chunkSize, file)) > 0u)
+    {
+        bytes += n;
+        if (isTLisp)
+        {
+            if (!takeForms(forms.Feed(chunk.data(), (uint)n), false))
+                return;
+            continue;
+        }
+        if (isJson && outcome.Failed)
+            continue;
+        pending.insert(pending.end(), chunk.begin(), chunk.begin() + n);
+        if (isJson)
+        {
+            uint errorOffset;
+            if (!document.Scan(pending.data(), (uint)pending.size(), options, errorOffset))
+            {
+                outcome.Fail(base + errorOffset);
+                continue;
+            }
+            auto consumable = document.GetConsumable();
+            pending.erase(pending.begin(), pending.begin() + consumable);
+            document.Consume(consumable);
+            base += consumable;
+            continue;
+        }
+        auto end = records.Scan(pending.data(), (uint)pending.size());
+        if (options.Grammar == "ndjson")
+            ParseNdjson(pending.data(), end, base, options, outcome);
+        else
+            ParseCsv(pending.data(), end, base, options, outcome);
+        pending.erase(pending.begin(), pending.begin() + end);
+        records.Consume(end);
+        base += end;
+    }
 
-    //MeasureTime(1000000, [s,p] () {
-    //    auto tParser = p(s);
-    //    s.Stream.Back(4);
-    //});
+    if (isTLisp)
+        takeForms(forms.Finish(), true);
+    else if (isJson)
+    {
+        if (document.IsScalar())
+            ParseJson(pending.data(), (uint)pending.size(), options, outcome);
+        else if (!document.IsClosed())
+            outcome.Fail(base + (uint)pending.size());
+        else if (!outcome.Failed)
+            outcome.Records++;
+    }
+    else if (options.Grammar == "ndjson")
+        ParseNdjson(pending.data(), (uint)pending.size(), base, options, outcome);
+    else
+        ParseCsv(pending.data(), (uint)pending.size(), base, options, outcome);
+}
 
-    getchar();
-    return 0;
+void ReportError(const string& path, const Outcome& outcome, const uint8* data, uint length)
+{
+    cerr << path;
+    if (data != nullptr)
+    {
+        AsciiTextStream stream(data, length);
+        auto position = stream.GetPosition(min(outcome.ErrorOffset, length));
+        cerr << ":" << position.Line << ":" << position.Column;
+    }
+    cerr << ": error: parse failed at byte " << outcome.ErrorOffset;
+    if (!outcome.Expected.empty())
+        cerr << ", " << outcome.Expected;
+    cerr << "\n";
 }
 
+auto ParseArguments(int argc, char* argv[], Options& options) -> bool
+{
+    for (auto i = 1; i < argc; i++)
+    {
+        string arg(argv[i]);
+        auto value = [&] () -> string
+        {
+            return i + 1 < argc ? string(argv[++i]) : string();
+        };
+        if (arg == "-g" || arg == "--grammar")
+        {
+            options.Grammar = value();
+        }
+        else if (arg == "-t" || arg == "--threads")
+        {
+            options.Threads = (uint)max(0, atoi(value().c_str()));
+        }
+        else if (arg == "-r" || arg == "--repeat")
+        {
+            options.Repeat = (uint)max(1, atoi(value().c_str()));
+        }
+        else if (arg == "-w" || arg == "--warmup")
+        {
+            options.Warmup = (uint)max(0, atoi(value().c_str()));
+        }
+        else if (arg == "-c" || arg == "--cache")
+        {
+            options.CacheBytes = (size_t)max(0, atoi(value().c_str())) * 1024u;
+        }
+        else if (arg == "-d" || arg == "--delimiter")
+        {
+            auto delimiter = value();
+            options.Delimiter = delimiter == "tab" ? '\t' : delimiter.empty() ? ',' : (uint8)delimiter[0];
+        }
+        else if (arg == "-s" || arg == "--stream")
+        {
+            auto kind = value();
+            if (kind == "ascii")
+                options.Stream = StreamKind::Ascii;
+            else if (kind == "utf8")
+                options.Stream = StreamKind::Utf8;
+            else if (kind == "mmap")
+                options.Stream = StreamKind::Mmap;
+            else if (kind == "streaming")
+                options.Stream = StreamKind::Streaming;
+            else
+                return false;
+        }
+        else if (arg.length() > 1u && arg[0] == '-')
+        {
+            return false;
+        }
+        else
+        {
+            options.Paths.push_back(arg);
+        }
+    }
+    if (options.Paths.empty())
+        options.Paths.push_back("-");
+    auto& grammar = options.Grammar;
+    return grammar == "json" || grammar == "ndjson" || grammar == "csv" || grammar == "tlisp";
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!ParseArguments(argc, argv, options))
+    {
+        cerr << "usage: TextSurvey.Console [-g json|ndjson|csv|tlisp] [-s ascii|utf8|mmap|streaming]\n"
+                "                          [-t threads] [-r repeat] [-w warmup] [-d delimiter]\n"
+                "                          [-c cache KiB] [file...]\n"
+                "       -s utf8 decodes UTF-8 for tlisp only; json, ndjson and csv read bytes\n";
+        return 2;
+    }
+    auto streaming = options.Stream == StreamKind::Streaming;
+    auto readsStdin = false;
+    for (auto& path : options.Paths)
+        readsStdin = readsStdin || path == "-";
+    if (streaming && readsStdin && options.Repeat + options.Warmup > 1u)
+    {
+        cerr << "stdin can only be streamed once; ignoring --repeat and --warmup\n";
+        options.Repeat = 1u;
+        options.Warmup = 0u;
+    }
+
+    GetJsonCache().SetBudget(options.CacheBytes);
+
+    vector<unique_ptr<Input>> inputs;
+    if (!streaming)
+    {
+        for (auto& path : options.Paths)
+        {
+            unique_ptr<Input> input(new Input());
+            if (!input->Load(path, options.Stream == StreamKind::Mmap))
+            {
+                cerr << path << ": cannot read, or 4 GiB or larger\n";
+                return 2;
+            }
+            inputs.push_back(move(input));
+        }
+    }
+
+    uint64_t bytes = 0u;
+    uint64_t records = 0u;
+    auto errors = 0u;
+    size_t allocations = 0u;
+    chrono::duration<double> elapsed(0.0);
+    for (auto run = 0u; run < options.Warmup + options.Repeat; run++)
+    {
+        auto measured = run >= options.Warmup;
+        auto allocationsBefore = GetAllocationCount();
+        auto start = chrono::steady_clock::now();
+        for (auto i = 0u; i < options.Paths.size(); i++)
+        {
+            Outcome outcome;
+            uint64_t inputBytes = 0u;
+            const uint8* data = nullptr;
+            auto length = 0u;
+            if (streaming)
+            {
+                auto& path = options.Paths[i];
+                auto file = path == "-" ? stdin : fopen(path.c_str(), "rb");
+                if (file == nullptr)
+                {
+                    cerr << path << ": cannot read\n";
+                    return 2;
+                }
+                ParseStreaming(options, file, inputBytes, outcome);
+                if (file != stdin)
+                    fclose(file);
+            }
+            else
+            {
+                data = inputs[i]->GetData();
+                length = inputs[i]->GetLength();
+                inputBytes = length;
+                ParseBuffered(options, data, length, outcome);
+            }
+            if (!measured)
+                continue;
+            bytes += inputBytes;
+            records += outcome.Records;
+            if (!outcome.Failed)
+                continue;
+            errors++;
+            if (run == options.Warmup)
+                ReportError(options.Paths[i], outcome, data, length);
+        }
+        if (measured)
+        {
+            elapsed += chrono::steady_clock::now() - start;
+            allocations += GetAllocationCount() - allocationsBefore;
+        }
+    }
+
+    auto seconds = max(elapsed.count(), 1e-9);
+    cout << "grammar:     " << options.Grammar << "\n";
+    cout << "inputs:      " << options.Paths.size() << " x " << options.Repeat << " runs\n";
+    cout << "bytes:       " << bytes << "\n";
+    cout << "records:     " << records << "\n";
+    cout << "time:        " << seconds << " s\n";
+    cout << "throughput:  " << (bytes / seconds / (1024.0 * 1024.0)) << " MiB/s, " << (records / seconds) << " records/s\n";
+    cout << "peak RSS:    " << PeakResidentKilobytes() << " KiB\n";
+    cout << "allocations: " << allocations / options.Repeat << " per run\n";
+    cout << "errors:      " << errors / options.Repeat << "\n";
+    if (options.CacheBytes != 0u)
+    {
+        auto stats = GetJsonCache().GetStats();
+        cout << "cache:       " << stats.Hits << " hits, " << stats.Misses << " misses (" << stats.GetHitRate() * 100.0 << "%), "
+             << stats.BytesSaved << " bytes saved, " << stats.Evictions << " evictions\n";
+    }
+    return errors == 0u ? 0 : 1;
+}
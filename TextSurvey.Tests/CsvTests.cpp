@@ -0,0 +1,79 @@
+#include "Common.h"
+#include "../TextSurvey/Csv.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace TextSurvey;
+using namespace Csv;
+
+namespace TextSurveyTests
+{
+	TEST_CLASS(CsvTests)
+	{
+	public:
+		TEST_METHOD(ReadRowsWithQuotingAndCrlf)
+		{
+            string text("id,name,note\r\n1,\"Smith, J\",\"said \"\"hi\"\"\"\r\n2,,\"multi\nline\"\r\n3,x,");
+            CsvReader reader((const uint8*)text.c_str(), (uint)text.length());
+            CsvRow row;
+            Assert::IsTrue(reader.Next(row));
+            Assert::AreEqual((size_t)3u, row.Fields.size());
+            Assert::AreEqual(string("note"), row.Fields[2].ToString());
+            Assert::IsTrue(reader.Next(row));
+            Assert::IsTrue(row.Fields[1].Quoted);
+            Assert::IsFalse(row.Fields[1].Escaped);
+            Assert::AreEqual(string("Smith, J"), row.Fields[1].ToString());
+            Assert::IsTrue(row.Fields[2].Escaped);
+            Assert::AreEqual(string("said \"hi\""), row.Fields[2].ToString());
+            Assert::IsTrue(reader.Next(row));
+            Assert::AreEqual(0u, row.Fields[1].Length);
+            Assert::AreEqual(string("multi\nline"), row.Fields[2].ToString());
+            Assert::IsTrue(reader.Next(row));
+            Assert::AreEqual((size_t)3u, row.Fields.size());
+            Assert::AreEqual(0u, row.Fields[2].Length);
+            Assert::IsFalse(reader.Next(row));
+            Assert::IsFalse(reader.HasFailed());
+
+            string tsv("a\tb\nc\td\n");
+            CsvReader tabs((const uint8*)tsv.c_str(), (uint)tsv.length(), CsvOptions::Tsv());
+            Assert::IsTrue(tabs.Next(row));
+            Assert::IsTrue(tabs.Next(row));
+            Assert::AreEqual(string("d"), row.Fields[1].ToString());
+            Assert::IsFalse(tabs.Next(row));
+
+            string bad("a,b\nc,\"d\"e\n");
+            CsvReader broken((const uint8*)bad.c_str(), (uint)bad.length());
+            Assert::IsTrue(broken.Next(row));
+            Assert::IsFalse(broken.Next(row));
+            Assert::IsTrue(broken.HasFailed());
+            Assert::AreEqual(9u, broken.GetErrorOffset());
+		}
+
+		TEST_METHOD(ReadAllMatchesSequentialRows)
+		{
+            string text;
+            for (auto i = 0u; i < 20000u; i++)
+            {
+                text += to_string(i);
+                text += i % 7u == 0u ? ",\"quoted, \"\"with\"\"\nbreak\"," : ",plain,";
+                text += i % 2u == 0u ? "end\r\n" : "end\n";
+            }
+            auto data = (const uint8*)text.c_str();
+            CsvTable sequential;
+            Assert::IsTrue(ReadAll(data, (uint)text.length(), sequential));
+            Assert::AreEqual(20000u, sequential.GetRowCount());
+            for (auto threads = 2u; threads <= 8u; threads *= 2u)
+            {
+                CsvTable parallel;
+                Assert::IsTrue(ReadAll(data, (uint)text.length(), parallel, CsvOptions(), threads));
+                Assert::AreEqual(sequential.GetRowCount(), parallel.GetRowCount());
+                for (auto r = 0u; r < parallel.GetRowCount(); r++)
+                {
+                    Assert::AreEqual(3u, parallel.GetFieldCount(r));
+                    Assert::AreEqual(to_string(r), parallel.GetField(r, 0u).ToString());
+                    Assert::IsTrue(parallel.GetField(r, 1u).Data == sequential.GetField(r, 1u).Data);
+                }
+            }
+            Assert::AreEqual(string("quoted, \"with\"\nbreak"), sequential.GetField(7u, 1u).ToString());
+		}
+	};
+}
@@ -0,0 +1,245 @@
+#include "Common.h"
+#include "../TextSurvey/JsonWriter.h"
+#include "../TextSurvey/JsonQuery.h"
+#include "../TextSurvey/JsonBind.h"
+#include "../TextSurvey/JsonParser.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace TextSurvey;
+using namespace Json;
+
+namespace TextSurveyTests
+{	
+    struct BoundUser
+    {
+        int Id;
+        string Name;
+    };
+
+    struct BoundEvent
+    {
+        string Type;
+        BoundUser User;
+        vector<uint> Tags;
+        Option<double> Score;
+        Option<double> Weight;
+        bool Active;
+    };
+}
+
+namespace Json
+{
+    template<>
+    struct JsonSchema<TextSurveyTests::BoundUser>
+    {
+        typedef TextSurveyTests::BoundUser T;
+
+        static constexpr auto Fields() -> decltype(make_tuple(Field("id", &T::Id), Field("name", &T::Name)))
+        {
+            return make_tuple(Field("id", &T::Id), Field("name", &T::Name));
+        }
+    };
+
+    template<>
+    struct JsonSchema<TextSurveyTests::BoundEvent>
+    {
+        typedef TextSurveyTests::BoundEvent T;
+
+        static constexpr auto Fields() -> decltype(make_tuple(
+            Field("type", &T::Type), Field("user", &T::User), Field("tags", &T::Tags),
+            Field("score", &T::Score), Field("weight", &T::Weight), Field("active", &T::Active)))
+        {
+            return make_tuple(
+                Field("type", &T::Type), Field("user", &T::User), Field("tags", &T::Tags),
+                Field("score", &T::Score), Field("weight", &T::Weight), Field("active", &T::Active));
+        }
+    };
+}
+
+namespace TextSurveyTests
+{	
+
+	TEST_CLASS(JsonTests)
+	{
+    private:
+
+        static auto Number(double value) -> unique_ptr<JsonValue>
+        {
+            auto n = new JsonNumber();
+            n->Value = value;
+            return unique_ptr<JsonValue>(n);
+        }
+
+        static auto String(const string& value) -> unique_ptr<JsonValue>
+        {
+            auto s = new JsonString();
+            s->Value = value;
+            return unique_ptr<JsonValue>(s);
+        }
+
+        static auto FormatNumber(double value) -> string
+        {
+            char buffer[32];
+            return string(buffer, FormatDouble(value, buffer));
+        }
+
+	public:		
+		TEST_METHOD(FormatDoubleRoundTrips)
+		{
+            Assert::AreEqual(string("0.1"), FormatNumber(0.1));
+            Assert::AreEqual(string("5"), FormatNumber(5.0));
+            Assert::AreEqual(string("-2.5"), FormatNumber(-2.5));
+            Assert::AreEqual(string("0.3333333333333333"), FormatNumber(1.0 / 3.0));
+            double values[] = { 1e21, 5e-324, 1.7976931348623157e308, 123456.789, 0.1 + 0.2 };
+            for (auto value : values)
+                Assert::IsTrue(strtod(FormatNumber(value).c_str(), nullptr) == value);
+		}
+
+		TEST_METHOD(WriteEscapesStrings)
+		{
+            string text("a long string with \"quotes\", a \\ backslash and\ta tab \x01 and more text");
+            Assert::AreEqual(
+                string("\"a long string with \\\"quotes\\\", a \\\\ backslash and\\ta tab \\u0001 and more text\""),
+                ToString(*String(text)));
+            Assert::AreEqual(string("\"caf\xC3\xA9\""), ToString(*String("caf\xC3\xA9")));
+		}
+
+		TEST_METHOD(WriteObjectsAndArrays)
+		{
+            JsonObject object;
+            auto array = new JsonArray();
+            array->Elements.push_back(Number(1.0));
+            array->Elements.push_back(unique_ptr<JsonValue>(new JsonNull()));
+            auto flag = new JsonBoolean();
+            flag->Value = true;
+            object.Set("a", unique_ptr<JsonValue>(array));
+            object.Set("b", unique_ptr<JsonValue>(flag));
+            object.Set("c", unique_ptr<JsonValue>(new JsonObject()));
+            Assert::AreEqual(string("{\"a\":[1,null],\"b\":true,\"c\":{}}"), ToString(object));
+            Assert::AreEqual(
+                string("{\n  \"a\": [\n    1,\n    null\n  ],\n  \"b\": true,\n  \"c\": {}\n}"),
+                ToString(object, JsonWriteOptions(true)));
+		}
+
+		TEST_METHOD(ParseBuildsTreesAndReportsErrors)
+		{
+            string text(" {\"a\": [1, null, \"x\\ny\"], \"b\": {\"c\": false}} ");
+            unique_ptr<JsonValue> value(Parse(text));
+            Assert::IsTrue(value != nullptr);
+            Assert::IsTrue(value->GetType() == JsonValueType::Object);
+            Assert::AreEqual(string("{\"a\":[1,null,\"x\\ny\"],\"b\":{\"c\":false}}"), ToString(*value));
+
+            uint errorOffset;
+            unique_ptr<JsonValue> broken(Parse(string("[1, 2,, 3]"), &errorOffset));
+            Assert::IsTrue(broken == nullptr);
+            Assert::AreEqual(6u, errorOffset);
+            Assert::IsTrue(Parse(string("[1] 2")) == nullptr);
+		}
+
+		TEST_METHOD(ObjectsShareInternedKeys)
+		{
+            auto keys = make_shared<JsonKeyTable>();
+            unique_ptr<JsonValue> first(Parse(string("{\"id\": 1, \"name\": \"a\"}"), nullptr, keys));
+            unique_ptr<JsonValue> second(Parse(string("{\"name\": \"b\", \"i\\u0064\": 2, \"id\": 3}"), nullptr, keys));
+            Assert::AreEqual(2u, keys->GetCount());
+            auto& a = (const JsonObject&)*first;
+            auto& b = (const JsonObject&)*second;
+            Assert::AreEqual(2u, b.GetCount());
+            Assert::IsTrue(a.GetMembers()[0].Key.Text == b.GetMembers()[1].Key.Text);
+            auto id = keys->Intern(string("id"));
+            Assert::AreEqual(3.0, ((JsonNumber*)b.Find(id))->Value);
+            Assert::AreEqual(string("{\"name\":\"b\",\"id\":3}"), ToString(b));
+
+            unique_ptr<JsonValue> third(Parse(string("[{\"id\": 4}]")));
+            unique_ptr<JsonValue> fourth(Parse(string("{\"id\": 5}")));
+            auto& inner = (const JsonObject&)*((const JsonArray&)*third).Elements[0];
+            Assert::IsTrue(inner.GetMembers()[0].Key.Text == ((const JsonObject&)*fourth).GetMembers()[0].Key.Text);
+            third.reset();
+            Assert::AreEqual(string("{\"id\":5}"), ToString(*fourth));
+
+            unique_ptr<JsonValue> root(Parse(string("[{\"key\": 1}]"), nullptr, make_shared<JsonKeyTable>()));
+            auto detached = move(((JsonArray&)*root).Elements[0]);
+            root.reset();
+            Assert::AreEqual(string("{\"key\":1}"), ToString(*detached));
+
+            JsonObject copy;
+            {
+                auto other = make_shared<JsonKeyTable>();
+                copy.Set(other->Intern(string("name")), Number(1.0));
+            }
+            Assert::AreEqual(string("{\"name\":1}"), ToString(copy));
+
+            JsonObject large;
+            for (auto i = 0; i < 40; i++)
+                large.Set("k" + to_string(i), Number(i));
+            large.Set("k7", Number(-1.0));
+            Assert::AreEqual(40u, large.GetCount());
+            for (auto i = 0; i < 40; i++)
+                Assert::AreEqual(i == 7 ? -1.0 : (double)i, ((JsonNumber*)large.Find("k" + to_string(i)))->Value);
+            Assert::IsTrue(large.Find(string("k40")) == nullptr);
+            Assert::IsTrue(large.Find(id) == nullptr);
+		}
+
+		TEST_METHOD(QueryEvaluatesSeveralPathsInOnePass)
+		{
+            string text(
+                "{\"skip\": {\"deep\": [1, \"]}\", {\"x\": 2}]}, "
+                "\"events\": [{\"user\": {\"id\": 7, \"name\": \"a\\\"b\"}}, "
+                "{\"user\": {\"id\": 8}}, {\"other\": true}], "
+                "\"a\": {\"b\": [\"first\", \"second\"]}}");
+            auto data = (const uint8*)text.c_str();
+            JsonQuery query;
+            Assert::AreEqual(0, query.Add("$.events[*].user.id"));
+            Assert::AreEqual(1, query.Add("/a/b/0"));
+            Assert::AreEqual(2, query.Add("$['events'][0].user.name"));
+            Assert::AreEqual(-1, query.Add("$..id"));
+
+            vector<JsonMatch> matches;
+            Assert::IsTrue(query.Run(data, (uint)text.length(), matches));
+            Assert::AreEqual((size_t)4u, matches.size());
+            Assert::AreEqual(0u, matches[0].Path);
+            Assert::AreEqual(string("7"), matches[0].GetText(data));
+            Assert::AreEqual(2u, matches[1].Path);
+            string name;
+            Assert::IsTrue(matches[1].GetString(data, name));
+            Assert::AreEqual(string("a\"b"), name);
+            double id;
+            Assert::IsTrue(matches[2].GetNumber(data, id));
+            Assert::AreEqual(8.0, id);
+            Assert::AreEqual(1u, matches[3].Path);
+            Assert::AreEqual(string("\"first\""), matches[3].GetText(data));
+		}
+
+		TEST_METHOD(DeserializeBindsStructs)
+		{
+            string text(
+                "{\"type\": \"click\", \"unknown\": {\"a\": [1, {\"b\": \"}\"}]}, "
+                "\"user\": {\"id\": -12, \"name\": \"Ann\\u00e9\"}, \"tags\": [1, 2, 3], "
+                "\"score\": 2.5, \"weight\": null, \"\\u0061ctive\": true}");
+            BoundEvent event;
+            event.Active = false;
+            Assert::IsTrue(Deserialize(text, event));
+            Assert::AreEqual(string("click"), event.Type);
+            Assert::AreEqual(-12, event.User.Id);
+            Assert::AreEqual(string("Ann\xC3\xA9"), event.User.Name);
+            Assert::AreEqual((size_t)3u, event.Tags.size());
+            Assert::AreEqual(3u, event.Tags[2]);
+            Assert::IsTrue(event.Score.IsSome());
+            Assert::AreEqual(2.5, event.Score.GetValue());
+            Assert::IsFalse(event.Weight.IsSome());
+            Assert::IsTrue(event.Active);
+
+            Assert::IsFalse(Deserialize(string("{\"tags\": [1, -2]}"), event));
+            Assert::IsFalse(Deserialize(string("{\"type\": \"x\"} trailing"), event));
+
+            Assert::IsTrue(Deserialize(string("{\"user\": {\"id\": -2147483648}, \"tags\": [4294967295]}"), event));
+            Assert::AreEqual(numeric_limits<int>::min(), event.User.Id);
+            Assert::AreEqual(4294967295u, event.Tags[0]);
+            Assert::IsFalse(Deserialize(string("{\"user\": {\"id\": 2147483648}}"), event));
+            Assert::IsFalse(Deserialize(string("{\"user\": {\"id\": -2147483649}}"), event));
+            Assert::IsFalse(Deserialize(string("{\"tags\": [4294967296]}"), event));
+            Assert::IsFalse(Deserialize(string("{\"tags\": [18446744073709551616]}"), event));
+            Assert::IsFalse(Deserialize(string("{\"tags\": [99999999999999999999]}"), event));
+		}
+	};
+}
@@ -0,0 +1,502 @@
+#include "Common.h"
+#include "../TextSurvey/TextSurvey.h"
+#include "../TextSurvey/Lexer.h"
+#include "../TextSurvey/Optimizer.h"
+#include "../TextSurvey/ParseCache.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+using namespace TextSurvey;
+
+namespace TextSurveyTests
+{	
+
+	TEST_CLASS(ParserTests)
+	{
+    private:
+
+        static auto CountItems(ParserType(string, unit) item, const string& text, ParseSession* session) -> uint
+        {
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            State<unit> state(ts, nullptr, session);
+            auto count = 0u;
+            while (item(state).Code == ResultCode::Success)
+                count++;
+            return count;
+        }
+
+	public:		
+		TEST_METHOD(ReparseAfterEditReusesUntouchedResults)
+		{
+            auto calls = make_shared<uint>(0u);
+            auto ab = Match<unit>(string("ab"));
+            ParserType(string, unit) counted = [ab, calls] (State<unit> state) -> Result<string>
+            {
+                (*calls)++;
+                return ab(state);
+            };
+            auto item = Memo<string, unit>(counted);
+            string text;
+            for (auto i = 0u; i < 1000u; i++)
+                text += "ab";
+
+            ParseSession session;
+            Assert::AreEqual(1000u, CountItems(item, text, &session));
+            Assert::AreEqual(1001u, *calls);
+
+            vector<Edit> edits;
+            edits.push_back(Edit(0u, 0u, "ab"));
+            edits.push_back(Edit(1000u, 2u, "ab"));
+            ApplyEdits(text, edits);
+            session.Apply(edits);
+            *calls = 0u;
+            Assert::AreEqual(1001u, CountItems(item, text, &session));
+            Assert::AreEqual(2u, *calls);
+
+            vector<Edit> breaking;
+            breaking.push_back(Edit(11u, 1u, "x"));
+            ApplyEdits(text, breaking);
+            session.Apply(breaking);
+            *calls = 0u;
+            Assert::AreEqual(5u, CountItems(item, text, &session));
+            Assert::AreEqual(1u, *calls);
+
+            text += "ab";
+            session.Apply(Edit((uint)text.length() - 2u, 0u, "ab"));
+            *calls = 0u;
+            Assert::AreEqual(5u, CountItems(item, text, &session));
+            Assert::AreEqual(0u, *calls);
+		}
+
+		TEST_METHOD(MemoReplaysFailuresOnHits)
+		{
+            auto item = Memo<string, unit>(Match<unit>(string("ab")));
+            string text("ababx");
+            ParseSession session;
+            for (auto run = 0u; run < 2u; run++)
+            {
+                AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+                FailureTracker failures;
+                State<unit> state(ts, nullptr, &session, nullptr, &failures);
+                while (item(state).Code == ResultCode::Success);
+                Assert::IsTrue(failures.HasFailed());
+                Assert::AreEqual(4u, failures.GetOffset());
+                Assert::AreEqual(string("expected \"ab\""), failures.DescribeExpected());
+            }
+            Assert::AreEqual(3u, session.GetHitCount());
+		}
+
+		TEST_METHOD(MemoDetachesResultsFromTheArena)
+		{
+            ParserType(ArenaVector<uchar>, unit) word = [] (State<unit> state) -> Result<ArenaVector<uchar>>
+            {
+                ArenaVector<uchar> letters((ArenaAllocator<uchar>(state.Memory)));
+                uchar c;
+                while (state.Stream.Next(&c) == 1u && c == 'a')
+                    letters.push_back(c);
+                return Result<ArenaVector<uchar>>(letters);
+            };
+            auto item = Memo<ArenaVector<uchar>, unit>(word);
+            string text("aaaa");
+            ParseSession session;
+            Arena memory;
+            {
+                AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+                State<unit> state(ts, nullptr, &session, &memory);
+                Assert::AreEqual((size_t)4u, item(state).Value.size());
+            }
+            memory.Reset();
+            memset(memory.Allocate(256u), 'x', 256u);
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            State<unit> state(ts, nullptr, &session, &memory);
+            auto result = item(state);
+            Assert::AreEqual(1u, session.GetHitCount());
+            Assert::AreEqual((size_t)4u, result.Value.size());
+            for (auto c : result.Value)
+                Assert::AreEqual((uchar)'a', c);
+		}
+
+		TEST_METHOD(ParseBatchMatchesSequentialResults)
+		{
+            Grammar<string, unit> grammar(Match<unit>(string("true")));
+            vector<string> texts;
+            for (auto i = 0u; i < 500u; i++)
+                texts.push_back(i % 3u == 0u ? "false" : "true");
+            vector<TextInput> inputs;
+            for (auto& text : texts)
+                inputs.push_back(TextInput((uint8*)text.c_str(), (uint)text.length()));
+
+            for (auto threads = 1u; threads <= 8u; threads *= 2u)
+            {
+                vector<FailureTracker> failures(inputs.size());
+                auto results = ParseBatch(grammar, inputs, threads, (const unit*)nullptr, nullptr, failures.data());
+                Assert::AreEqual(inputs.size(), results.size());
+                for (auto i = 0u; i < results.size(); i++)
+                {
+                    auto expected = i % 3u == 0u ? ResultCode::Failure : ResultCode::Success;
+                    Assert::IsTrue(results[i].Code == expected);
+                    Assert::AreEqual(i % 3u == 0u, failures[i].HasFailed());
+                }
+            }
+
+            Grammar<ArenaVector<uchar>, unit> letters(ManyInArena(Match<unit>((uchar)'t')));
+            vector<unique_ptr<Arena>> arenas;
+            auto held = ParseBatch(letters, inputs, 4u, (const unit*)nullptr, &arenas);
+            for (auto& result : held)
+                Assert::IsTrue(result.Value.get_allocator().Memory != nullptr);
+		}
+
+		TEST_METHOD(PushParserResumesAcrossChunks)
+		{
+            auto item = Memo<string, unit>(Match<unit>(string("ab")));
+            Grammar<tuple<string, string>, unit> grammar(Sequence(item, Match<unit>(string("cd"))));
+            PushParser<tuple<string, string>, unit> parser(grammar);
+            Assert::IsTrue(parser.Feed((const uint8*)"a", 1u) == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)"bc", 2u) == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)"dab", 3u) == FeedStatus::Done);
+            Assert::AreEqual(4u, parser.GetConsumed());
+            Assert::AreEqual(string("cd"), get<1>(parser.GetResult().Value));
+
+            Assert::IsTrue(parser.Feed((const uint8*)"cdab", 4u) == FeedStatus::Done);
+            Assert::IsTrue(parser.Next() == FeedStatus::Done);
+            Assert::AreEqual(4u, parser.GetConsumed());
+            Assert::IsTrue(parser.Next() == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)"cx", 2u) == FeedStatus::Error);
+
+            PushParser<tuple<string, string>, unit> truncated(grammar);
+            Assert::IsTrue(truncated.Feed((const uint8*)"abc", 3u) == FeedStatus::NeedMore);
+            Assert::IsTrue(truncated.Finish() == FeedStatus::Error);
+		}
+
+		TEST_METHOD(PushParserResumesRepetitionsAfterCompletedItems)
+		{
+            auto calls = make_shared<uint>(0u);
+            auto match = Match<unit>(string("ab"));
+            function<Result<string>(State<unit>)> item = [calls, match] (State<unit> state) -> Result<string>
+            {
+                (*calls)++;
+                return match(state);
+            };
+            Grammar<tuple<vector<string>, uchar>, unit> grammar(Sequence(Many(item), Match<unit>((uchar)';')));
+            PushParser<tuple<vector<string>, uchar>, unit> parser(grammar);
+            string message("abababababababab;");
+            for (uint i = 0u; i + 1u < (uint)message.length(); i++)
+                Assert::IsTrue(parser.Feed((const uint8*)message.c_str() + i, 1u) == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)";\n", 2u) == FeedStatus::Done);
+            Assert::AreEqual((size_t)8u, get<0>(parser.GetResult().Value).size());
+            Assert::IsTrue(*calls <= 2u * (uint)message.length());
+		}
+
+		TEST_METHOD(PushParserSkipsPastFailedMessages)
+		{
+            Grammar<tuple<string, uchar>, unit> grammar(Sequence(Match<unit>(string("ab")), Match<unit>((uchar)';')));
+            PushParser<tuple<string, uchar>, unit> parser(grammar);
+            Assert::IsTrue(parser.Feed((const uint8*)"ax", 2u) == FeedStatus::Error);
+            Assert::IsTrue(parser.Feed((const uint8*)"x", 1u) == FeedStatus::Error);
+            Assert::IsTrue(parser.SkipPast((uint8)';') == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)"yy;a", 4u) == FeedStatus::NeedMore);
+            Assert::AreEqual((uint64_t)6u, parser.GetSkipped());
+            Assert::IsTrue(parser.Feed((const uint8*)"b;", 2u) == FeedStatus::Done);
+            Assert::AreEqual(3u, parser.GetConsumed());
+
+            Assert::IsTrue(parser.Next() == FeedStatus::NeedMore);
+            Assert::IsTrue(parser.Feed((const uint8*)"zab;", 4u) == FeedStatus::Error);
+            Assert::IsTrue(parser.Skip(1u) == FeedStatus::Done);
+            Assert::AreEqual((uint64_t)7u, parser.GetSkipped());
+		}
+
+		TEST_METHOD(CombinatorsRunOverTokens)
+		{
+            enum : uchar { Name = 1, Number, Let, Equals, EqualsEquals, Plus };
+            auto letters = CharSet::Between('a', 'z');
+            auto digits = CharSet::Between('0', '9');
+            Lexer lexer;
+            lexer.AddSkip(CharSet(" \t\r\n"));
+            lexer.AddToken(Name, letters, letters | digits);
+            lexer.AddToken(Number, digits, digits);
+            lexer.AddKeyword(Let, "let");
+            lexer.AddLiteral(Equals, "=");
+            lexer.AddLiteral(EqualsEquals, "==");
+            lexer.AddLiteral(Plus, "+");
+
+            string text("let x1 =\n   42 + y == z");
+            TokenBuffer tokens;
+            Assert::IsTrue(lexer.Tokenize((const uint8*)text.c_str(), (uint)text.length(), tokens));
+            Assert::AreEqual(8u, tokens.Size());
+            Assert::AreEqual((uchar)Let, tokens.Kinds[0]);
+            Assert::AreEqual((uchar)EqualsEquals, tokens.Kinds[6]);
+
+            TokenStream ts((const uint8*)text.c_str(), (uint)text.length(), tokens);
+            Assert::AreEqual((uint)text.length(), ts.GetLength());
+            Assert::AreEqual(8u, ts.GetEnd());
+            State<unit> state(ts);
+            auto comparison = Sequence(MatchToken<unit>(Name), Match<unit>((uchar)EqualsEquals), MatchToken<unit>(Name));
+            auto binding = Sequence(Match<unit>((uchar)Let), MatchToken<unit>(Name), Match<unit>((uchar)Equals));
+            Assert::IsTrue(comparison(state).Code == ResultCode::Failure);
+            Assert::AreEqual(0u, ts.GetOffset());
+            auto result = binding(state);
+            Assert::IsTrue(result.Code == ResultCode::Success);
+            Assert::AreEqual(4u, get<1>(result.Value).Start);
+            Assert::AreEqual(string("x1"), ts.GetTokenText(1u));
+            auto position = ts.GetPosition();
+            Assert::AreEqual(2u, position.Line);
+            Assert::AreEqual(4u, position.Column);
+
+            string bad("let #");
+            TokenBuffer badTokens;
+            Assert::IsFalse(lexer.Tokenize((const uint8*)bad.c_str(), (uint)bad.length(), badTokens));
+            Assert::AreEqual(4u, lexer.GetErrorOffset());
+		}
+
+		TEST_METHOD(RepetitionHonoursRanges)
+		{
+            string text("aaaa,b");
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            State<unit> state(ts);
+            auto a = Match<unit>((uchar)'a');
+            Assert::IsTrue(Many(a, Range(5u, 6u))(state).Code == ResultCode::Failure);
+            Assert::AreEqual(0u, ts.GetOffset());
+            auto three = Many(a, Range(1u, 3u))(state);
+            Assert::AreEqual((size_t)3u, three.Value.size());
+            auto rest = Split(a, Match<unit>((uchar)','), OneOrMore)(state);
+            Assert::AreEqual((size_t)1u, rest.Value.size());
+            Assert::AreEqual(4u, ts.GetOffset());
+            auto none = Many(a)(state);
+            Assert::IsTrue(none.Code == ResultCode::Success);
+            Assert::AreEqual((size_t)0u, none.Value.size());
+		}
+
+		TEST_METHOD(ArenaHoldsRepetitionResults)
+		{
+            string text(1000u, 'a');
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            Arena arena(256u);
+            State<unit> state(ts, nullptr, nullptr, &arena);
+            auto result = ManyInArena(Match<unit>((uchar)'a'))(state);
+            Assert::AreEqual((size_t)1000u, result.Value.size());
+            Assert::IsTrue(result.Value.get_allocator() == ArenaAllocator<uchar>(&arena));
+            Assert::IsTrue(arena.GetAllocationCount() > 0u);
+            Assert::IsTrue(arena.GetPeakBytes() >= 1000u * sizeof(uchar));
+            result = Result<ArenaVector<uchar>>();
+            arena.Reset();
+            Assert::AreEqual((size_t)0u, arena.GetUsedBytes());
+            Assert::AreEqual((size_t)0u, arena.GetAllocationCount());
+            Assert::IsTrue(arena.Allocate(8u) != nullptr);
+		}
+
+		TEST_METHOD(OptimizeFusesDescribedRules)
+		{
+            auto isDigit = [] (uchar c) { return c >= '0' && c <= '9'; };
+            auto number = Many(SatisfyRule<unit>(isDigit), OneOrMore);
+            auto keyword = Choice(Choice(MatchRule<unit>("true"), MatchRule<unit>("false")), MatchRule<unit>("null"));
+            auto arrow = Sequence(MatchRule<unit>((uchar)'-'), MatchRule<unit>((uchar)'>'));
+            auto nested = Between(MatchRule<unit>((uchar)'('), Between(MatchRule<unit>((uchar)'['), number, MatchRule<unit>((uchar)']')), MatchRule<unit>((uchar)')'));
+
+            OptimizeReport report;
+            auto fastNumber = Optimize(number, report);
+            auto fastKeyword = Optimize(keyword, report);
+            auto fastArrow = Optimize(arrow, report);
+            auto fastNested = Optimize(nested, report);
+            Assert::IsTrue(fastNumber.Info->Kind == ParserKind::TakeWhile);
+            Assert::IsTrue(fastKeyword.Info->Kind == ParserKind::KeywordSet);
+            Assert::AreEqual((size_t)3u, fastKeyword.Info->Literals.size());
+            Assert::IsTrue(fastArrow.Info->Kind == ParserKind::Literal);
+            Assert::IsTrue(fastNested.Info->Kind == ParserKind::Between);
+            Assert::AreEqual((size_t)5u, fastNested.Info->Children.size());
+            Assert::AreEqual((size_t)6u, report.Rewrites.size());
+
+            string text("12345678901234567890x->nul([42])([7)");
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            State<unit> state(ts);
+            Assert::AreEqual((size_t)20u, fastNumber(state).Value.size());
+            Assert::AreEqual(20u, ts.GetOffset());
+            Assert::AreEqual(21u, ts.GetExtent());
+            Assert::IsTrue(fastKeyword(state).Code == ResultCode::Failure);
+            uchar x;
+            ts.Next(&x, 1u);
+            Assert::IsTrue(get<1>(fastArrow(state).Value) == '>');
+            Assert::IsTrue(fastKeyword(state).Code == ResultCode::Failure);
+            Assert::AreEqual(23u, ts.GetOffset());
+            ts.Next(&x, 1u);
+            ts.Next(&x, 1u);
+            ts.Next(&x, 1u);
+            Assert::AreEqual((size_t)2u, fastNested(state).Value.size());
+            Assert::IsTrue(fastNested(state).Code == ResultCode::Failure);
+            Assert::AreEqual(32u, ts.GetOffset());
+
+            string words("falsetrue");
+            AsciiTextStream ws((uint8*)words.c_str(), (uint)words.length());
+            State<unit> wordState(ws);
+            Assert::AreEqual(string("false"), fastKeyword(wordState).Value);
+            Assert::AreEqual(string("true"), keyword(wordState).Value);
+            Assert::AreEqual(9u, ws.GetOffset());
+		}
+
+		TEST_METHOD(FusedRulesKeepUnfusedExtents)
+		{
+            auto abc = Sequence(MatchRule<unit>((uchar)'a'), MatchRule<unit>((uchar)'b'), MatchRule<unit>((uchar)'c'));
+            auto fastAbc = Optimize(abc);
+            Assert::IsTrue(fastAbc.Info->Kind == ParserKind::Literal);
+            const char* texts[] = { "abxdefghijklmnop", "axc", "ab", "x", "abcd" };
+            for (auto text : texts)
+            {
+                auto length = (uint)strlen(text);
+                AsciiTextStream slow((const uint8*)text, length);
+                AsciiTextStream fast((const uint8*)text, length);
+                State<unit> slowState(slow);
+                State<unit> fastState(fast);
+                Assert::IsTrue(abc(slowState).Code == fastAbc(fastState).Code);
+                Assert::AreEqual(slow.GetOffset(), fast.GetOffset());
+                Assert::AreEqual(slow.GetExtent(), fast.GetExtent());
+            }
+
+            auto optional = Optimize(Choice(MatchRule<unit>(string("x")), MatchRule<unit>(string(""))));
+            Assert::IsTrue(optional.Info->Kind == ParserKind::Choice);
+            string text("y");
+            AsciiTextStream ts((const uint8*)text.c_str(), (uint)text.length());
+            State<unit> state(ts);
+            Assert::IsTrue(optional(state).Code == ResultCode::Success);
+		}
+
+		TEST_METHOD(InstrumentationCountsNamedRules)
+		{
+            string text("aaaa,aa,aaa");
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            Instrumentation probe;
+            auto callbacks = 0u;
+            probe.SetCallback([&callbacks] (const InstrumentSnapshot&) { callbacks++; }, 2u);
+            ts.SetInstrumentation(&probe);
+            auto word = Named("word", ManyInArena(Match<unit>((uchar)'a'), OneOrMore));
+            auto list = Named("list", SplitInArena(word, Match<unit>((uchar)',')));
+            State<unit> state(ts);
+            auto result = list(state);
+            Assert::AreEqual((size_t)3u, result.Value.size());
+            auto stats = probe.GetSnapshot();
+#if defined(TEXTSURVEY_INSTRUMENT)
+            RuleStats words, lists;
+            for (auto& rule : stats.Rules)
+            {
+                if (rule.Name == "word")
+                    words = rule;
+                else if (rule.Name == "list")
+                    lists = rule;
+            }
+            Assert::AreEqual((uint64_t)3u, words.Calls);
+            Assert::AreEqual((uint64_t)1u, lists.Calls);
+            Assert::IsTrue(words.Allocations >= 3u);
+            Assert::IsTrue(lists.Allocations > words.Allocations);
+            Assert::IsTrue(lists.Bytes >= 9u * sizeof(uchar));
+            Assert::AreEqual((size_t)2u, stats.Rules.size());
+            Assert::AreEqual((uint64_t)4u, stats.RuleCalls);
+            Assert::AreEqual(2u, callbacks);
+            Assert::AreEqual(0u, stats.LiveSnapshots);
+            Assert::IsTrue(stats.PeakSnapshots >= 2u);
+            Assert::AreEqual(11u, stats.MaxSnapshotReach);
+            Assert::IsTrue(stats.PeakResultBytes > 0u);
+
+            // A later probe on the same thread starts from its own peak.
+            string small("a");
+            AsciiTextStream ss((uint8*)small.c_str(), (uint)small.length());
+            Instrumentation smallProbe;
+            ss.SetInstrumentation(&smallProbe);
+            State<unit> smallState(ss);
+            Assert::AreEqual((size_t)1u, list(smallState).Value.size());
+            Assert::IsTrue(smallProbe.GetSnapshot().PeakResultBytes < stats.PeakResultBytes);
+
+            // A rule built again under the same name adds to the same stats.
+            auto again = Named("word", ManyInArena(Match<unit>((uchar)'a'), OneOrMore));
+            string more("aa");
+            AsciiTextStream ms((uint8*)more.c_str(), (uint)more.length());
+            ms.SetInstrumentation(&smallProbe);
+            State<unit> moreState(ms);
+            Assert::IsTrue(again(moreState).Code == ResultCode::Success);
+            auto smallStats = smallProbe.GetSnapshot();
+            Assert::AreEqual((size_t)2u, smallStats.Rules.size());
+            Assert::AreEqual(string("word"), smallStats.Rules[0].Name);
+            Assert::AreEqual((uint64_t)2u, smallStats.Rules[0].Calls);
+#else
+            Assert::AreEqual((size_t)0u, stats.Rules.size());
+            Assert::AreEqual(0u, callbacks);
+#endif
+		}
+
+		TEST_METHOD(FailureTrackerReportsFarthestExpected)
+		{
+            auto isSpace = [] (uchar c) { return c == ' ' || c == '\n'; };
+            auto isDigit = [] (uchar c) { return c >= '0' && c <= '9'; };
+            auto value = Choice(
+                Sequence(Match<unit>((uchar)'('), Match<unit>((uchar)')')),
+                Bind<vector<uchar>, tuple<uchar, uchar>, unit>(
+                    Expect("number", Many(Satisfy<unit>(isDigit), OneOrMore)),
+                    [] (vector<uchar>) { return Return<tuple<uchar, uchar>, unit>(make_tuple((uchar)'0', (uchar)'0')); }));
+            auto binding = Sequence(Match<unit>(string("let")), Many(Satisfy<unit>(isSpace)), value);
+
+            string text("let\n  x");
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            FailureTracker failures;
+            State<unit> state(ts, nullptr, nullptr, nullptr, &failures);
+            Assert::IsTrue(binding(state).Code == ResultCode::Failure);
+            Assert::IsTrue(failures.HasFailed());
+            Assert::AreEqual(6u, failures.GetOffset());
+            Assert::AreEqual((size_t)2u, failures.GetExpected().size());
+            Assert::AreEqual(string("line 2, column 3: unexpected input, expected '(' or number"), failures.GetMessage(ts));
+
+            string open("let (");
+            AsciiTextStream os((uint8*)open.c_str(), (uint)open.length());
+            failures.Reset();
+            State<unit> openState(os, nullptr, nullptr, nullptr, &failures);
+            Assert::IsTrue(binding(openState).Code == ResultCode::Failure);
+            Assert::AreEqual(string("line 1, column 6: unexpected end of input, expected ')'"), failures.GetMessage(os));
+
+            auto keyword = Optimize(Choice(MatchRule<unit>(string("if")), MatchRule<unit>(string("in"))));
+            string word("ix");
+            AsciiTextStream ws((uint8*)word.c_str(), (uint)word.length());
+            failures.Reset();
+            State<unit> wordState(ws, nullptr, nullptr, nullptr, &failures);
+            Assert::IsTrue(keyword(wordState).Code == ResultCode::Failure);
+            Assert::AreEqual(0u, failures.GetOffset());
+            Assert::AreEqual(string("expected \"if\" or \"in\""), failures.DescribeExpected());
+		}
+
+		TEST_METHOD(ParseCacheReusesResultsWithinBudget)
+		{
+            auto calls = make_shared<uint>(0u);
+            auto word = Many(Match<unit>((uchar)'a'), OneOrMore);
+            Grammar<uint, unit> grammar([calls, word] (State<unit> state) -> Result<uint>
+            {
+                (*calls)++;
+                auto result = word(state);
+                if (result.Code == ResultCode::Failure)
+                    return Result<uint>();
+                return Result<uint>((uint)result.Value.size());
+            });
+            ParseCache<uint, unit> cache(2u * (sizeof(uint) + 4u), [] (const uint&, uint length) { return sizeof(uint) + length; });
+            string a("aaaa"), b("aaab"), c("aa"), d("aaa");
+            auto input = [] (const string& text) { return TextInput((const uint8*)text.c_str(), (uint)text.length()); };
+
+            Assert::AreEqual(4u, *cache.Parse(grammar, input(a)));
+            Assert::AreEqual(4u, *cache.Parse(grammar, input(string(a))));
+            Assert::AreEqual(1u, *calls);
+            Assert::AreEqual(3u, *cache.Parse(grammar, input(b)));
+            Assert::AreEqual(2u, *cache.Parse(grammar, input(c)));
+            FailureTracker failures;
+            Assert::IsTrue(cache.Parse(grammar, input(string("b")), &failures) == nullptr);
+            Assert::IsTrue(failures.HasFailed());
+            Assert::AreEqual(0u, failures.GetOffset());
+            auto stats = cache.GetStats();
+            Assert::AreEqual((uint64_t)1u, stats.Hits);
+            Assert::AreEqual((uint64_t)4u, stats.Misses);
+            Assert::AreEqual((uint64_t)4u, stats.BytesSaved);
+            Assert::AreEqual(2u, stats.Entries);
+
+            // a was used least recently, so c pushed it out.
+            Assert::AreEqual((uint64_t)1u, stats.Evictions);
+            cache.Parse(grammar, input(b));
+            Assert::AreEqual(4u, *calls);
+            cache.Parse(grammar, input(a));
+            Assert::AreEqual(5u, *calls);
+            Assert::AreEqual(3u, *cache.Parse(grammar, input(d)));
+            cache.SetBudget(0u);
+            Assert::AreEqual(0u, cache.GetStats().Entries);
+		}
+	};
+}
@@ -94,5 +94,84 @@ namespace TextSurveyTests
             Assert::AreEqual(0u, ts.GetOffset());
             Assert::AreEqual(0u, ts.GetCharOffset());
 		}
+
+		TEST_METHOD(NextAndBackWithUtf8TextStream)
+		{
+            const uint byteCount = 7;
+            uint8 cs[byteCount];
+            cs[0] = 'a';
+            EncodeUtf8Char(0x20AC, cs + 1);
+            cs[4] = 'b';
+            EncodeUtf8Char(0xA2, cs + 5);
+            Utf8TextStream ts(cs, byteCount);
+            uchar data[4];
+            Assert::AreEqual(4u, ts.Next(data, 4));
+            Assert::AreEqual((uchar)0xA2, data[3]);
+            Assert::AreEqual(1u, ts.Back(1));
+            Assert::AreEqual(5u, ts.GetOffset());
+            Assert::AreEqual(1u, ts.Back(1));
+            Assert::AreEqual(4u, ts.GetOffset());
+            Assert::AreEqual(2u, ts.GetCharOffset());
+            Assert::AreEqual(1u, ts.Back(1));
+            Assert::AreEqual(1u, ts.GetOffset());
+            Assert::AreEqual(2u, ts.Next(data, 2));
+            Assert::AreEqual((uchar)0x20AC, data[0]);
+            Assert::AreEqual((uchar)'b', data[1]);
+            Assert::AreEqual(1u, ts.Next(data, 4));
+            Assert::AreEqual((uchar)0xA2, data[0]);
+            Assert::AreEqual(byteCount, ts.GetOffset());
+            Assert::AreEqual(0u, ts.Next(data, 1));
+
+            uint8 truncated[3];
+            EncodeUtf8Char(0x20AC, truncated);
+            Utf8TextStream tail(truncated, 2u);
+            Assert::AreEqual(1u, tail.Next(data, 2));
+            Assert::AreEqual(2u, tail.GetOffset());
+		}
+
+		TEST_METHOD(GetPositionWithAsciiTextStream)
+		{
+            string text("ab\ncd\r\n\nefghijklmnopqrstuvwxyz\nz");
+            AsciiTextStream ts((uint8*)text.c_str(), (uint)text.length());
+            auto start = ts.GetPosition();
+            Assert::AreEqual(1u, start.Line);
+            Assert::AreEqual(1u, start.Column);
+            auto last = ts.GetPosition(ts.GetLength() - 1);
+            Assert::AreEqual(5u, last.Line);
+            Assert::AreEqual(1u, last.Column);
+            auto past = ts.GetPosition(ts.GetLength() + 100u);
+            Assert::AreEqual(5u, past.Line);
+            Assert::AreEqual(2u, past.Column);
+            auto middle = ts.GetPosition(4u);
+            Assert::AreEqual(2u, middle.Line);
+            Assert::AreEqual(2u, middle.Column);
+            auto empty = ts.GetPosition(7u);
+            Assert::AreEqual(3u, empty.Line);
+            Assert::AreEqual(1u, empty.Column);
+            auto wide = ts.GetPosition(29u);
+            Assert::AreEqual(4u, wide.Line);
+            Assert::AreEqual(22u, wide.Column);
+		}
+
+		TEST_METHOD(GetPositionWithUtf8TextStream)
+		{
+            const uint byteCount = 9;
+            uint8 cs[byteCount];
+            cs[0] = '\n';
+            EncodeUtf8Char(0xA2, cs + 1);
+            EncodeUtf8Char(0x20AC, cs + 3);
+            cs[6] = 'a';
+            cs[7] = '\n';
+            cs[8] = 'b';
+            Utf8TextStream ts(cs, byteCount);
+            auto position = ts.GetPosition(6u);
+            Assert::AreEqual(2u, position.Line);
+            Assert::AreEqual(3u, position.Column);
+            uchar data[5];
+            Assert::AreEqual(5u, ts.Next(data, 5));
+            position = ts.GetPosition();
+            Assert::AreEqual(3u, position.Line);
+            Assert::AreEqual(1u, position.Column);
+		}
 	};
 }
\ No newline at end of file
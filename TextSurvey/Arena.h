@@ -0,0 +1,268 @@
+#pragma once
+
+#include "Common.h"
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <tuple>
+#include <utility>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    // Bump allocator for the results of one parse. Individual frees are
+    // no-ops; Reset releases everything at once and keeps the chunks for
+    // the next parse.
+    class Arena
+    {
+    private:
+
+        struct Chunk
+        {
+            uint8* Data;
+            size_t Size;
+        };
+
+        const size_t _chunkSize;
+        vector<Chunk> _chunks;
+        size_t _current;
+        uint8* _position;
+        uint8* _end;
+        size_t _retired;
+        size_t _allocations;
+        size_t _peak;
+
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        void* AllocateSlow(size_t size, size_t alignment)
+        {
+            if (_position != nullptr)
+                _retired += (size_t)(_position - _chunks[_current].Data);
+            auto next = _position == nullptr ? 0u : _current + 1u;
+            while (next < _chunks.size() && _chunks[next].Size < size + alignment)
+                next++;
+            if (next == _chunks.size())
+            {
+                Chunk chunk;
+                chunk.Size = max(_chunkSize, size + alignment);
+                chunk.Data = (uint8*)malloc(chunk.Size);
+                if (chunk.Data == nullptr)
+                    throw bad_alloc();
+                _chunks.push_back(chunk);
+            }
+            else if (next != _current + 1u && _position != nullptr)
+            {
+                swap(_chunks[_current + 1u], _chunks[next]);
+                next = _current + 1u;
+            }
+            _current = next;
+            _position = _chunks[_current].Data;
+            _end = _position + _chunks[_current].Size;
+            return Allocate(size, alignment);
+        }
+
+    public:
+
+        Arena(size_t chunkSize = 1u << 16) :
+            _chunkSize(chunkSize), _current(0u), _position(nullptr), _end(nullptr),
+            _retired(0u), _allocations(0u), _peak(0u)
+        {
+
+        }
+
+        ~Arena()
+        {
+            for (auto& chunk : _chunks)
+                free(chunk.Data);
+        }
+
+        inline void* Allocate(size_t size, size_t alignment = sizeof(void*))
+        {
+            auto p = (uint8*)(((uintptr_t)_position + alignment - 1u) & ~(uintptr_t)(alignment - 1u));
+            if (_position == nullptr || p + size > _end)
+                return AllocateSlow(size, alignment);
+            _position = p + size;
+            _allocations++;
+            auto used = GetUsedBytes();
+            if (used > _peak)
+                _peak = used;
+            return p;
+        }
+
+        // Releases every allocation at once. Destructors are not run.
+        void Reset()
+        {
+            _current = 0u;
+            _position = _chunks.empty() ? nullptr : _chunks[0].Data;
+            _end = _chunks.empty() ? nullptr : _chunks[0].Data + _chunks[0].Size;
+            _retired = 0u;
+            _allocations = 0u;
+            _peak = 0u;
+        }
+
+        inline size_t GetAllocationCount() const
+        {
+            return _allocations;
+        }
+
+        inline size_t GetUsedBytes() const
+        {
+            if (_position == nullptr)
+                return _retired;
+            return _retired + (size_t)(_position - _chunks[_current].Data);
+        }
+
+        inline size_t GetPeakBytes() const
+        {
+            return _peak;
+        }
+
+        inline size_t GetReservedBytes() const
+        {
+            size_t total = 0u;
+            for (auto& chunk : _chunks)
+                total += chunk.Size;
+            return total;
+        }
+    };
+
+    // Result allocations that went to the heap because no Arena was given;
+    // only counted when TEXTSURVEY_INSTRUMENT is defined.
+    struct HeapCounters
+    {
+        uint64_t Allocations;
+        uint64_t Bytes;
+        size_t Live;
+        size_t Peak;
+    };
+
+    inline auto ResultHeap() -> HeapCounters&
+    {
+        static thread_local HeapCounters counters = { 0u, 0u, 0u, 0u };
+        return counters;
+    }
+
+    // Standard allocator over an Arena; without one it uses the heap.
+    template<typename T>
+    class ArenaAllocator
+    {
+    public:
+
+        typedef T value_type;
+
+        Arena* Memory;
+
+        ArenaAllocator(Arena* memory = nullptr) :
+            Memory(memory)
+        {
+
+        }
+
+        template<typename T2>
+        ArenaAllocator(const ArenaAllocator<T2>& other) :
+            Memory(other.Memory)
+        {
+
+        }
+
+        inline T* allocate(size_t count)
+        {
+            if (Memory == nullptr)
+            {
+#if defined(TEXTSURVEY_INSTRUMENT)
+                auto& heap = ResultHeap();
+                heap.Allocations++;
+                heap.Bytes += count * sizeof(T);
+                heap.Live += count * sizeof(T);
+                if (heap.Live > heap.Peak)
+                    heap.Peak = heap.Live;
+#endif
+                return (T*)::operator new(count * sizeof(T));
+            }
+            return (T*)Memory->Allocate(count * sizeof(T), alignof(T));
+        }
+
+        inline void deallocate(T* p, size_t count)
+        {
+            if (Memory != nullptr)
+                return;
+#if defined(TEXTSURVEY_INSTRUMENT)
+            ResultHeap().Live -= count * sizeof(T);
+#else
+            (void)count;
+#endif
+            ::operator delete(p);
+        }
+
+        template<typename T2>
+        inline bool operator==(const ArenaAllocator<T2>& other) const
+        {
+            return Memory == other.Memory;
+        }
+
+        template<typename T2>
+        inline bool operator!=(const ArenaAllocator<T2>& other) const
+        {
+            return Memory != other.Memory;
+        }
+    };
+
+    template<typename T>
+    using ArenaVector = vector<T, ArenaAllocator<T>>;
+
+    // Makes the allocator of a result container: an ArenaAllocator draws
+    // from memory, any other allocator ignores it.
+    template<typename TAllocator>
+    struct ResultAllocator
+    {
+        static inline auto Make(Arena*) -> TAllocator
+        {
+            return TAllocator();
+        }
+    };
+
+    template<typename T>
+    struct ResultAllocator<ArenaAllocator<T>>
+    {
+        static inline auto Make(Arena* memory) -> ArenaAllocator<T>
+        {
+            return ArenaAllocator<T>(memory);
+        }
+    };
+
+    // A copy of value that owns no Arena memory, for results kept past the
+    // parse that made them. Covers ArenaVectors and tuples of them; other
+    // types that point into an Arena must not outlive it.
+    template<typename T>
+    inline auto Detach(const T& value) -> T
+    {
+        return value;
+    }
+
+    template<typename... T>
+    inline auto Detach(const tuple<T...>& value) -> tuple<T...>;
+
+    template<typename T>
+    auto Detach(const ArenaVector<T>& value) -> ArenaVector<T>
+    {
+        ArenaVector<T> copy;
+        copy.reserve(value.size());
+        for (auto& item : value)
+            copy.push_back(Detach(item));
+        return copy;
+    }
+
+    template<typename... T, size_t... I>
+    inline auto DetachTuple(const tuple<T...>& value, index_sequence<I...>) -> tuple<T...>
+    {
+        return tuple<T...>(Detach(get<I>(value))...);
+    }
+
+    template<typename... T>
+    inline auto Detach(const tuple<T...>& value) -> tuple<T...>
+    {
+        return DetachTuple(value, index_sequence_for<T...>());
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "Parsers.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    struct TextInput
+    {
+        const uint8* Data;
+        uint Length;
+
+        TextInput() :
+            Data(nullptr), Length(0u)
+        {
+
+        }
+
+        TextInput(const uint8* data, uint length) :
+            Data(data), Length(length)
+        {
+
+        }
+    };
+
+    // An immutable, shareable handle to a parser. The built-in combinators
+    // only capture their arguments by value and never write to them, and all
+    // per-parse data (stream, session, user state) travels in State, so one
+    // Grammar may be run from any number of threads at once as long as any
+    // custom parsers it contains obey the same rule.
+    template<typename R, typename U>
+    class Grammar
+    {
+    private:
+
+        shared_ptr<const function<Result<R>(State<U>)>> _parser;
+        uint _id;
+
+        static auto NewId() -> uint
+        {
+            static atomic<uint> next(1u);
+            return next++;
+        }
+
+    public:
+
+        Grammar(function<Result<R>(State<U>)> parser) :
+            _parser(make_shared<const function<Result<R>(State<U>)>>(parser)), _id(NewId())
+        {
+
+        }
+
+        inline auto operator()(State<U> state) const -> Result<R>
+        {
+            return (*_parser)(state);
+        }
+
+        inline uint GetId() const
+        {
+            return _id;
+        }
+    };
+
+    // Parses every input with grammar on up to threads workers (0 means one
+    // per hardware thread). Workers claim inputs in small blocks through a
+    // single atomic counter and build each result in place in its slot, so
+    // an ArenaVector result keeps its worker's arena and is never copied.
+    // When arenas is given each worker allocates its results from its own
+    // Arena, which is returned there and must outlive the results. When
+    // failures is given it holds one tracker per input, which records where
+    // that input's parse failed.
+    template<typename TStream = AsciiTextStream, typename R, typename U>
+    auto ParseBatch(
+        const Grammar<R, U>& grammar,
+        const TextInput* inputs,
+        uint count,
+        uint threads = 0u,
+        const U* userState = nullptr,
+        vector<unique_ptr<Arena>>* arenas = nullptr,
+        FailureTracker* failures = nullptr
+        ) -> vector<Result<R>>
+    {
+        const uint blockSize = 16u;
+        typedef typename aligned_storage<sizeof(Result<R>), alignof(Result<R>)>::type Slot;
+        unique_ptr<Slot[]> slots(new Slot[count]);
+        atomic<uint> next(0u);
+
+        if (threads == 0u)
+            threads = max(1u, (uint)thread::hardware_concurrency());
+        threads = max(1u, min(threads, (count + blockSize - 1u) / blockSize));
+        if (arenas != nullptr)
+        {
+            arenas->clear();
+            for (auto i = 0u; i < threads; i++)
+                arenas->push_back(unique_ptr<Arena>(new Arena()));
+        }
+
+        auto worker = [&grammar, inputs, count, userState, arenas, failures, &slots, &next] (uint index)
+        {
+            auto memory = arenas != nullptr ? (*arenas)[index].get() : nullptr;
+            for (;;)
+            {
+                auto begin = next.fetch_add(blockSize);
+                if (begin >= count)
+                    return;
+                auto end = min(begin + blockSize, count);
+                for (auto i = begin; i < end; i++)
+                {
+                    TStream stream(inputs[i].Data, inputs[i].Length);
+                    State<U> state(stream, userState, nullptr, memory, failures != nullptr ? failures + i : nullptr);
+                    new (&slots[i]) Result<R>(grammar(state));
+                }
+            }
+        };
+
+        vector<thread> workers;
+        for (auto i = 1u; i < threads; i++)
+            workers.push_back(thread(worker, i));
+        worker(0u);
+        for (auto& t : workers)
+            t.join();
+        vector<Result<R>> results;
+        results.reserve(count);
+        for (auto i = 0u; i < count; i++)
+        {
+            auto slot = (Result<R>*)&slots[i];
+            results.push_back(move(*slot));
+            slot->~Result<R>();
+        }
+        return results;
+    }
+
+    template<typename TStream = AsciiTextStream, typename R, typename U>
+    auto ParseBatch(
+        const Grammar<R, U>& grammar,
+        const vector<TextInput>& inputs,
+        uint threads = 0u,
+        const U* userState = nullptr,
+        vector<unique_ptr<Arena>>* arenas = nullptr,
+        FailureTracker* failures = nullptr
+        ) -> vector<Result<R>>
+    {
+        return ParseBatch<TStream>(grammar, inputs.data(), (uint)inputs.size(), threads, userState, arenas, failures);
+    }
+}
@@ -0,0 +1,409 @@
+#pragma once
+
+#include "TextStream.h"
+#include "Simd.h"
+#include <string>
+#include <thread>
+#include <atomic>
+
+using namespace std;
+
+namespace Csv
+{
+    struct CsvOptions
+    {
+        uint8 Delimiter;
+        uint8 Quote;
+
+        CsvOptions(uint8 delimiter = ',', uint8 quote = '"') :
+            Delimiter(delimiter), Quote(quote)
+        {
+
+        }
+
+        static auto Tsv() -> CsvOptions
+        {
+            return CsvOptions('\t');
+        }
+    };
+
+    // A field as a span of the input. Quoted fields exclude their quotes;
+    // Escaped fields still contain doubled quotes and need ToString.
+    struct CsvField
+    {
+        const uint8* Data;
+        uint Length;
+        bool Quoted;
+        bool Escaped;
+
+        CsvField() :
+            Data(nullptr), Length(0u), Quoted(false), Escaped(false)
+        {
+
+        }
+
+        CsvField(const uint8* data, uint length, bool quoted, bool escaped) :
+            Data(data), Length(length), Quoted(quoted), Escaped(escaped)
+        {
+
+        }
+
+        auto ToString(uint8 quote = '"') const -> string
+        {
+            string out;
+            if (!Escaped)
+            {
+                out.assign((const char*)Data, Length);
+                return out;
+            }
+            out.reserve(Length);
+            for (auto i = 0u; i < Length; i++)
+            {
+                out += (char)Data[i];
+                if (Data[i] == quote)
+                    i++;
+            }
+            return out;
+        }
+    };
+
+    struct CsvRow
+    {
+        vector<CsvField> Fields;
+        uint Offset;
+
+        CsvRow() :
+            Offset(0u)
+        {
+
+        }
+    };
+
+    // Reads RFC 4180 rows one at a time. Structural bytes (delimiter, quote,
+    // CR, LF) are located 64 bytes at a time and everything between them is
+    // skipped without being examined. Rows end at LF, CRLF or a lone CR.
+    class CsvReader
+    {
+    private:
+
+        const uint8* _data;
+        uint _length;
+        uint _offset;
+        CsvOptions _options;
+        uint _blockStart;
+        uint64_t _mask;
+        bool _failed;
+        uint _errorOffset;
+
+        static inline uint64_t ScalarMask(const uint8* data, uint count, uint8 delimiter, uint8 quote)
+        {
+            uint64_t mask = 0u;
+            for (auto i = 0u; i < count; i++)
+            {
+                auto c = data[i];
+                if (c == delimiter || c == quote || c == '\n' || c == '\r')
+                    mask |= (uint64_t)1u << i;
+            }
+            return mask;
+        }
+
+#if defined(TEXTSURVEY_AVX2)
+        static inline uint64_t BlockMask(const uint8* data, uint8 delimiter, uint8 quote)
+        {
+            auto d = _mm256_set1_epi8((char)delimiter);
+            auto q = _mm256_set1_epi8((char)quote);
+            auto lf = _mm256_set1_epi8('\n');
+            auto cr = _mm256_set1_epi8('\r');
+            uint64_t mask = 0u;
+            for (auto i = 0u; i < 64u; i += 32u)
+            {
+                auto block = _mm256_loadu_si256((const __m256i*)(data + i));
+                auto hits = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpeq_epi8(block, d), _mm256_cmpeq_epi8(block, q)),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(block, lf), _mm256_cmpeq_epi8(block, cr)));
+                mask |= (uint64_t)(uint)_mm256_movemask_epi8(hits) << i;
+            }
+            return mask;
+        }
+#elif defined(TEXTSURVEY_SSE2)
+        static inline uint64_t BlockMask(const uint8* data, uint8 delimiter, uint8 quote)
+        {
+            auto d = _mm_set1_epi8((char)delimiter);
+            auto q = _mm_set1_epi8((char)quote);
+            auto lf = _mm_set1_epi8('\n');
+            auto cr = _mm_set1_epi8('\r');
+            uint64_t mask = 0u;
+            for (auto i = 0u; i < 64u; i += 16u)
+            {
+                auto block = _mm_loadu_si128((const __m128i*)(data + i));
+                auto hits = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, d), _mm_cmpeq_epi8(block, q)),
+                    _mm_or_si128(_mm_cmpeq_epi8(block, lf), _mm_cmpeq_epi8(block, cr)));
+                mask |= (uint64_t)(uint)_mm_movemask_epi8(hits) << i;
+            }
+            return mask;
+        }
+#else
+        static inline uint64_t BlockMask(const uint8* data, uint8 delimiter, uint8 quote)
+        {
+            return ScalarMask(data, 64u, delimiter, quote);
+        }
+#endif
+
+        // Position of the first structural byte at or after from, or _length.
+        inline uint NextStructural(uint from)
+        {
+            for (;;)
+            {
+                if (from >= _blockStart && from < _blockStart + 64u)
+                {
+                    auto mask = _mask & (~(uint64_t)0u << (from - _blockStart));
+                    if (mask != 0u)
+                        return _blockStart + TextSurvey::Simd::TrailingZeros(mask);
+                    from = _blockStart + 64u;
+                }
+                if (from >= _length)
+                    return _length;
+                _blockStart = from;
+                _mask = from + 64u <= _length
+                    ? BlockMask(_data + from, _options.Delimiter, _options.Quote)
+                    : ScalarMask(_data + from, _length - from, _options.Delimiter, _options.Quote);
+            }
+        }
+
+        inline bool Fail(uint offset)
+        {
+            _failed = true;
+            _errorOffset = offset;
+            _offset = _length;
+            return false;
+        }
+
+    public:
+
+        CsvReader(const uint8* data, uint length, const CsvOptions& options = CsvOptions()) :
+            _data(data), _length(length), _offset(0u), _options(options),
+            _blockStart(~0u - 64u), _mask(0u), _failed(false), _errorOffset(0u)
+        {
+
+        }
+
+        CsvReader(TextSurvey::TextStream& stream, const CsvOptions& options = CsvOptions()) :
+            _data(stream.GetData()), _length(stream.GetLength()), _offset(0u), _options(options),
+            _blockStart(~0u - 64u), _mask(0u), _failed(false), _errorOffset(0u)
+        {
+
+        }
+
+        // Reads the next row into row, reusing its storage. Returns false at
+        // the end of the input or on malformed quoting.
+        bool Next(CsvRow& row)
+        {
+            row.Fields.clear();
+            row.Offset = _offset;
+            if (_offset >= _length)
+                return false;
+            auto fieldStart = _offset;
+            auto position = _offset;
+            auto quoted = false;
+            auto escaped = false;
+            auto quoteEnd = 0u;
+            for (;;)
+            {
+                auto p = NextStructural(position);
+                auto c = p < _length ? _data[p] : (uint8)0u;
+                if (quoted && quoteEnd == 0u)
+                {
+                    if (p == _length)
+                        return Fail(fieldStart);
+                    if (c != _options.Quote)
+                    {
+                        position = p + 1u;
+                        continue;
+                    }
+                    if (p + 1u < _length && _data[p + 1u] == _options.Quote)
+                    {
+                        escaped = true;
+                        position = p + 2u;
+                        continue;
+                    }
+                    quoteEnd = p;
+                    position = p + 1u;
+                    continue;
+                }
+                if (p < _length && c == _options.Quote)
+                {
+                    if (p != fieldStart || quoted)
+                        return Fail(p);
+                    quoted = true;
+                    position = p + 1u;
+                    continue;
+                }
+                if (quoted && p != quoteEnd + 1u)
+                    return Fail(quoteEnd + 1u);
+                if (quoted)
+                    row.Fields.push_back(CsvField(_data + fieldStart + 1u, quoteEnd - fieldStart - 1u, true, escaped));
+                else
+                    row.Fields.push_back(CsvField(_data + fieldStart, p - fieldStart, false, false));
+                if (p < _length && c == _options.Delimiter)
+                {
+                    fieldStart = position = p + 1u;
+                    quoted = escaped = false;
+                    quoteEnd = 0u;
+                    continue;
+                }
+                _offset = p + 1u;
+                if (c == '\r' && _offset < _length && _data[_offset] == '\n')
+                    _offset++;
+                return true;
+            }
+        }
+
+        inline bool HasFailed() const
+        {
+            return _failed;
+        }
+
+        inline uint GetErrorOffset() const
+        {
+            return _errorOffset;
+        }
+
+        inline uint GetOffset() const
+        {
+            return _offset;
+        }
+
+        inline void SetOffset(uint offset)
+        {
+            _offset = offset;
+        }
+    };
+
+    // Rows stored flat: row r's fields are Fields[RowStarts[r], RowStarts[r + 1]).
+    struct CsvTable
+    {
+        vector<CsvField> Fields;
+        vector<uint> RowStarts;
+        bool Failed;
+        uint ErrorOffset;
+
+        CsvTable() :
+            Failed(false), ErrorOffset(0u)
+        {
+
+        }
+
+        inline uint GetRowCount() const
+        {
+            return RowStarts.empty() ? 0u : (uint)RowStarts.size() - 1u;
+        }
+
+        inline uint GetFieldCount(uint row) const
+        {
+            return RowStarts[row + 1u] - RowStarts[row];
+        }
+
+        inline auto GetField(uint row, uint column) const -> const CsvField&
+        {
+            return Fields[RowStarts[row] + column];
+        }
+    };
+
+    inline bool ReadRange(const uint8* data, uint begin, uint end, const CsvOptions& options, CsvTable& table)
+    {
+        CsvReader reader(data, end, options);
+        reader.SetOffset(begin);
+        CsvRow row;
+        if (table.RowStarts.empty())
+            table.RowStarts.push_back(0u);
+        while (reader.Next(row))
+        {
+            table.Fields.insert(table.Fields.end(), row.Fields.begin(), row.Fields.end());
+            table.RowStarts.push_back((uint)table.Fields.size());
+        }
+        if (reader.HasFailed() && !table.Failed)
+        {
+            table.Failed = true;
+            table.ErrorOffset = reader.GetErrorOffset();
+        }
+        return !reader.HasFailed();
+    }
+
+    // Reads every row of data on up to threads workers (0 means one per
+    // hardware thread). Chunk boundaries are moved to the next row break
+    // outside quotes, found from the parity of the quotes before it, so the
+    // input must use RFC 4180 quoting: quotes only around whole fields.
+    inline bool ReadAll(
+        const uint8* data,
+        uint length,
+        CsvTable& table,
+        const CsvOptions& options = CsvOptions(),
+        uint threads = 1u
+        )
+    {
+        const uint minChunk = 1u << 16;
+        table = CsvTable();
+        if (threads == 0u)
+            threads = max(1u, (uint)thread::hardware_concurrency());
+        threads = max(1u, min(threads, length / minChunk));
+        if (threads == 1u)
+            return ReadRange(data, 0u, length, options, table);
+
+        auto chunk = length / threads;
+        vector<uint> quotes(threads, 0u);
+        vector<uint> starts(threads + 1u, length);
+        vector<CsvTable> tables(threads);
+        auto countQuotes = [&] (uint index)
+        {
+            auto begin = index * chunk;
+            auto end = index + 1u == threads ? length : begin + chunk;
+            TextSurvey::Simd::FindEach(data, begin, end, options.Quote, [&] (uint) { quotes[index]++; });
+        };
+        auto readChunk = [&] (uint index)
+        {
+            ReadRange(data, starts[index], starts[index + 1u], options, tables[index]);
+        };
+        auto runAll = [threads] (function<void(uint)> work)
+        {
+            vector<thread> workers;
+            for (auto i = 1u; i < threads; i++)
+                workers.push_back(thread(work, i));
+            work(0u);
+            for (auto& t : workers)
+                t.join();
+        };
+
+        runAll(countQuotes);
+        starts[0] = 0u;
+        auto inside = false;
+        for (auto i = 1u; i < threads; i++)
+        {
+            inside ^= (quotes[i - 1u] & 1u) != 0u;
+            auto p = i * chunk;
+            auto quoted = inside;
+            while (p < length && (quoted || (data[p] != '\n' && data[p] != '\r')))
+                quoted ^= data[p++] == options.Quote;
+            if (p < length && data[p] == '\r' && p + 1u < length && data[p + 1u] == '\n')
+                p++;
+            starts[i] = max(starts[i - 1u], min(length, p + 1u));
+        }
+        runAll(readChunk);
+
+        for (auto& part : tables)
+        {
+            auto base = (uint)table.Fields.size();
+            if (table.RowStarts.empty())
+                table.RowStarts.push_back(0u);
+            table.Fields.insert(table.Fields.end(), part.Fields.begin(), part.Fields.end());
+            for (auto r = 1u; r < part.RowStarts.size(); r++)
+                table.RowStarts.push_back(base + part.RowStarts[r]);
+            if (part.Failed && !table.Failed)
+            {
+                table.Failed = true;
+                table.ErrorOffset = part.ErrorOffset;
+            }
+        }
+        return !table.Failed;
+    }
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include "TextStream.h"
+#include <string>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    inline auto DescribeChar(uchar value) -> string
+    {
+        if (value >= 0x20u && value < 0x7Fu)
+            return string("'") + (char)value + "'";
+        return "U+" + to_string(value);
+    }
+
+    // Records the farthest offset a parser failed at and which items were
+    // expected there, so a rejected input needs no second, diagnostic parse.
+    // Primitive parsers only touch it on their failure paths; the message is
+    // built only when asked for.
+    class FailureTracker
+    {
+    private:
+
+        // Expected items past this many at one offset are dropped.
+        static const uint MaxExpected = 16u;
+        // Descriptions past this many are not registered.
+        static const uint MaxDescriptions = 1u << 16;
+        // Chars and token kinds are encoded in their ids, so the parsers
+        // that expect them never register anything.
+        static const uint CharBit = 0x80000000u;
+        static const uint TokenBit = 0x40000000u;
+
+        bool _failed;
+        uint _offset;
+        uint _count;
+        uint _expected[MaxExpected];
+
+        static auto Descriptions() -> vector<string>&
+        {
+            static vector<string> descriptions;
+            return descriptions;
+        }
+
+        static auto DescriptionIds() -> map<string, uint>&
+        {
+            static map<string, uint> ids;
+            return ids;
+        }
+
+        static auto DescriptionsLock() -> mutex&
+        {
+            static mutex lock;
+            return lock;
+        }
+
+        static auto RegisterShared(const string& description) -> uint
+        {
+            lock_guard<mutex> guard(DescriptionsLock());
+            auto& ids = DescriptionIds();
+            auto found = ids.find(description);
+            if (found != ids.end())
+                return found->second;
+            auto& descriptions = Descriptions();
+            if (descriptions.size() >= MaxDescriptions)
+                return Unspecified;
+            descriptions.push_back(description);
+            ids[description] = (uint)descriptions.size() - 1u;
+            return (uint)descriptions.size() - 1u;
+        }
+
+    public:
+
+        // An id that names nothing; failing with it is the same as Fail(offset).
+        static const uint Unspecified = ~0u;
+
+        struct Mark
+        {
+            bool Failed;
+            uint Offset;
+            uint Count;
+        };
+
+        FailureTracker() :
+            _failed(false), _offset(0u), _count(0u)
+        {
+
+        }
+
+        // Returns the id of an expected item; equal descriptions share an id.
+        // Parsers call it through ExpectedItem, only once a failure is noted.
+        // A description this thread registered before is found without the
+        // global lock. Returns Unspecified once the registry is full.
+        static auto RegisterExpected(const string& description) -> uint
+        {
+            static thread_local map<string, uint> known;
+            auto cached = known.find(description);
+            if (cached != known.end())
+                return cached->second;
+            auto id = RegisterShared(description);
+            if (id != Unspecified)
+                known[description] = id;
+            return id;
+        }
+
+        static inline auto CharId(uchar value) -> uint
+        {
+            return CharBit | (value & (TokenBit - 1u));
+        }
+
+        static inline auto TokenId(uchar kind) -> uint
+        {
+            return TokenBit | (kind & (TokenBit - 1u));
+        }
+
+        static auto GetDescription(uint id) -> string
+        {
+            if ((id & CharBit) != 0u)
+                return DescribeChar(id & ~CharBit);
+            if ((id & TokenBit) != 0u)
+                return "token " + to_string(id & ~TokenBit);
+            lock_guard<mutex> guard(DescriptionsLock());
+            return Descriptions()[id];
+        }
+
+        void Reset()
+        {
+            _failed = false;
+            _offset = 0u;
+            _count = 0u;
+        }
+
+        // A failure at offset that expected nothing in particular.
+        inline void Fail(uint offset)
+        {
+            if (_failed && offset <= _offset)
+                return;
+            _failed = true;
+            _offset = offset;
+            _count = 0u;
+        }
+
+        inline void Fail(uint offset, uint id)
+        {
+            if (id == Unspecified)
+            {
+                Fail(offset);
+                return;
+            }
+            if (_failed && offset < _offset)
+                return;
+            if (!_failed || offset > _offset)
+            {
+                _failed = true;
+                _offset = offset;
+                _count = 0u;
+            }
+            for (auto i = 0u; i < _count; i++)
+            {
+                if (_expected[i] == id)
+                    return;
+            }
+            if (_count < MaxExpected)
+                _expected[_count++] = id;
+        }
+
+        // Notes everything other recorded, moved by delta bytes.
+        void Merge(const FailureTracker& other, int delta = 0)
+        {
+            if (!other._failed)
+                return;
+            auto offset = other._offset + delta;
+            if (other._count == 0u)
+                Fail(offset);
+            for (auto i = 0u; i < other._count; i++)
+                Fail(offset, other._expected[i]);
+        }
+
+        inline auto GetMark() const -> Mark
+        {
+            Mark mark = { _failed, _offset, _count };
+            return mark;
+        }
+
+        // Replaces what was expected at start since mark with id, unless
+        // something after start already failed further on.
+        void Relabel(const Mark& mark, uint start, uint id)
+        {
+            if (_failed && _offset > start)
+                return;
+            if (_failed && _offset == start)
+                _count = mark.Failed && mark.Offset == start ? mark.Count : 0u;
+            Fail(start, id);
+        }
+
+        inline auto HasFailed() const -> bool
+        {
+            return _failed;
+        }
+
+        inline auto GetOffset() const -> uint
+        {
+            return _offset;
+        }
+
+        auto GetExpected() const -> vector<uint>
+        {
+            return vector<uint>(_expected, _expected + _count);
+        }
+
+        // "expected 'a', 'b' or digit", or an empty string when nothing in
+        // particular was expected.
+        auto DescribeExpected() const -> string
+        {
+            if (_count == 0u)
+                return string();
+            string text("expected ");
+            for (auto i = 0u; i < _count; i++)
+            {
+                if (i > 0u)
+                    text += i + 1u == _count ? " or " : ", ";
+                text += GetDescription(_expected[i]);
+            }
+            return text;
+        }
+
+        // "line 3, column 7: unexpected input, expected ')' or atom", with the
+        // position taken from the stream the failed parse ran on.
+        auto GetMessage(TextStream& stream) const -> string
+        {
+            auto position = stream.GetPosition(min(_offset, stream.GetEnd()));
+            string text("line " + to_string(position.Line) + ", column " + to_string(position.Column) + ": ");
+            if (_offset >= stream.GetEnd())
+                text += "unexpected end of input";
+            else
+                text += "unexpected input";
+            if (_count > 0u)
+                text += ", " + DescribeExpected();
+            return text;
+        }
+    };
+
+    // A description that is registered with FailureTracker the first time a
+    // failure expecting it is noted, so building a parser takes no lock and
+    // allocates nothing beyond its text. Parsers keep it by value; a quoted
+    // item is a literal, whose description is only built when registered.
+    class ExpectedItem
+    {
+    private:
+
+        static const uint Unregistered = ~0u - 1u;
+
+        string _text;
+        bool _quoted;
+        mutable atomic<uint> _id;
+
+        ExpectedItem& operator=(const ExpectedItem&);
+
+    public:
+
+        explicit ExpectedItem(const string& text, bool quoted = false) :
+            _text(text), _quoted(quoted), _id(Unregistered)
+        {
+
+        }
+
+        ExpectedItem(const ExpectedItem& other) :
+            _text(other._text), _quoted(other._quoted), _id(other._id.load(memory_order_relaxed))
+        {
+
+        }
+
+        inline auto GetText() const -> const string&
+        {
+            return _text;
+        }
+
+        auto GetId() const -> uint
+        {
+            auto id = _id.load(memory_order_relaxed);
+            if (id == Unregistered)
+            {
+                id = FailureTracker::RegisterExpected(_quoted ? "\"" + _text + "\"" : _text);
+                _id.store(id, memory_order_relaxed);
+            }
+            return id;
+        }
+    };
+}
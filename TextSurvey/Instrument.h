@@ -0,0 +1,211 @@
+#pragma once
+
+#include "Arena.h"
+#include <string>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+// Define TEXTSURVEY_INSTRUMENT for the whole build to count allocations per
+// Named parser and track Snapshots. Without it Named returns its parser
+// unchanged, streams carry no probe and nothing here is called. Only result
+// storage that goes through ArenaAllocator (the Arena, or the heap when a
+// parse has none) is counted; other allocations made by parsers are not.
+
+namespace TextSurvey
+{
+    struct RuleStats
+    {
+        string Name;
+        uint64_t Calls;
+        uint64_t Allocations;
+        uint64_t Bytes;
+
+        RuleStats() :
+            Calls(0u), Allocations(0u), Bytes(0u)
+        {
+
+        }
+    };
+
+    struct InstrumentSnapshot
+    {
+        // The named rules called so far, in order of first call. Allocations
+        // and bytes are inclusive of nested named rules.
+        vector<RuleStats> Rules;
+        uint64_t RuleCalls;
+        uint LiveSnapshots;
+        uint PeakSnapshots;
+        // Farthest a live Snapshot sat behind the stream position, in bytes.
+        uint MaxSnapshotReach;
+        size_t PeakResultBytes;
+
+        InstrumentSnapshot() :
+            RuleCalls(0u), LiveSnapshots(0u), PeakSnapshots(0u), MaxSnapshotReach(0u), PeakResultBytes(0u)
+        {
+
+        }
+    };
+
+    // Collects the counters of one parse session. Attach it to the stream
+    // (or PushParser) that the parse runs on.
+    class Instrumentation
+    {
+    private:
+
+        // Names past this many are not registered.
+        static const uint MaxRules = 1u << 12;
+
+        InstrumentSnapshot _stats;
+        function<void(const InstrumentSnapshot&)> _callback;
+        uint64_t _interval;
+        // Index in _stats.Rules plus one for each rule id this probe has
+        // seen, 0 for the others.
+        vector<uint> _slots;
+
+        static auto RuleNames() -> vector<string>&
+        {
+            static vector<string> names;
+            return names;
+        }
+
+        static auto RuleIds() -> map<string, uint>&
+        {
+            static map<string, uint> ids;
+            return ids;
+        }
+
+        static auto RuleNamesLock() -> mutex&
+        {
+            static mutex lock;
+            return lock;
+        }
+
+    public:
+
+        struct Counters
+        {
+            uint64_t Allocations;
+            uint64_t Bytes;
+        };
+
+        Instrumentation() :
+            _interval(0u)
+        {
+
+        }
+
+        // An id that names no rule; calls to it only count in RuleCalls.
+        static const uint Unregistered = ~0u;
+
+        // Returns the id of a rule name; equal names share an id, so parsers
+        // built again (inside Bind, say) add to the same stats. Returns
+        // Unregistered once the registry is full.
+        static auto RegisterRule(const string& name) -> uint
+        {
+            static thread_local map<string, uint> known;
+            auto cached = known.find(name);
+            if (cached != known.end())
+                return cached->second;
+            lock_guard<mutex> guard(RuleNamesLock());
+            auto& ids = RuleIds();
+            auto found = ids.find(name);
+            if (found != ids.end())
+                return known[name] = found->second;
+            auto& names = RuleNames();
+            if (names.size() >= MaxRules)
+                return Unregistered;
+            names.push_back(name);
+            ids[name] = (uint)names.size() - 1u;
+            return known[name] = (uint)names.size() - 1u;
+        }
+
+        // Calls callback with a snapshot after every interval named rule calls.
+        void SetCallback(function<void(const InstrumentSnapshot&)> callback, uint64_t interval)
+        {
+            _callback = callback;
+            _interval = interval;
+        }
+
+        auto GetSnapshot() const -> InstrumentSnapshot
+        {
+            return _stats;
+        }
+
+        void Reset()
+        {
+            _stats = InstrumentSnapshot();
+            _slots.clear();
+            Attach();
+        }
+
+        // Starts the calling thread's result peak over from what is live
+        // now, so an earlier session's peak is not reported again. Streams
+        // call this when the probe is attached.
+        void Attach()
+        {
+            auto& heap = ResultHeap();
+            heap.Peak = heap.Live;
+        }
+
+        inline auto Measure(const Arena* memory) const -> Counters
+        {
+            auto& heap = ResultHeap();
+            Counters counters = { heap.Allocations, heap.Bytes };
+            if (memory != nullptr)
+            {
+                counters.Allocations += memory->GetAllocationCount();
+                counters.Bytes += memory->GetUsedBytes();
+            }
+            return counters;
+        }
+
+        void OnRule(uint rule, const Counters& before, const Arena* memory)
+        {
+            auto after = Measure(memory);
+            auto& rules = _stats.Rules;
+            if (rule != Unregistered)
+            {
+                if (rule >= _slots.size())
+                    _slots.resize(rule + 1u, 0u);
+                auto& slot = _slots[rule];
+                if (slot == 0u)
+                {
+                    lock_guard<mutex> guard(RuleNamesLock());
+                    rules.push_back(RuleStats());
+                    rules.back().Name = RuleNames()[rule];
+                    slot = (uint)rules.size();
+                }
+                auto& stats = rules[slot - 1u];
+                stats.Calls++;
+                stats.Allocations += after.Allocations - before.Allocations;
+                stats.Bytes += after.Bytes - before.Bytes;
+            }
+            auto peak = max(ResultHeap().Peak, memory != nullptr ? memory->GetPeakBytes() : (size_t)0u);
+            if (peak > _stats.PeakResultBytes)
+                _stats.PeakResultBytes = peak;
+            _stats.RuleCalls++;
+            if (_callback && _interval != 0u && _stats.RuleCalls % _interval == 0u)
+                _callback(_stats);
+        }
+
+        inline void OnSnapshot()
+        {
+            if (++_stats.LiveSnapshots > _stats.PeakSnapshots)
+                _stats.PeakSnapshots = _stats.LiveSnapshots;
+        }
+
+        inline void OnSnapshotReach(uint reach)
+        {
+            if (reach > _stats.MaxSnapshotReach)
+                _stats.MaxSnapshotReach = reach;
+        }
+
+        inline void OnSnapshotEnd(uint reach)
+        {
+            OnSnapshotReach(reach);
+            _stats.LiveSnapshots--;
+        }
+    };
+}
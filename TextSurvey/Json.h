@@ -1,6 +1,9 @@
 #pragma once
 
 #include "TextSurvey.h"
+#include <deque>
+#include <string>
+#include <cstring>
 
 namespace Json
 {
@@ -17,6 +20,11 @@ namespace Json
     class JsonValue 
     {
     public:
+        virtual ~JsonValue()
+        {
+
+        }
+
         virtual JsonValueType GetType() const = 0;
     };
 
@@ -65,43 +73,280 @@ namespace Json
         }
     };
 
-    class JsonObject : 
-        public JsonValue
+    // An interned object key. Keys from one JsonKeyTable are equal exactly
+    // when their Text pointers are; keys from different tables fall back to
+    // comparing text. A key can be kept as a handle for repeated lookups.
+    struct JsonKey
     {
-    public:
-        map<string, unique_ptr<JsonValue>> Members;
-        JsonValueType GetType() const
+        const string* Text;
+        uint32_t Hash;
+
+        JsonKey() :
+            Text(nullptr), Hash(0u)
         {
-            return JsonValueType::Object;
+
+        }
+
+        JsonKey(const string* text, uint32_t hash) :
+            Text(text), Hash(hash)
+        {
+
+        }
+
+        inline bool operator==(const JsonKey& other) const
+        {
+            return Text == other.Text || (Hash == other.Hash && *Text == *other.Text);
         }
     };
 
-    class JsonArray : 
-        public JsonValue
+    // Stores each distinct object key once. A table may be shared by many
+    // documents (such as the records of a JSON lines stream) but must only
+    // be interned into by one thread at a time; the objects that use it
+    // keep it alive.
+    class JsonKeyTable
     {
+    private:
+
+        deque<string> _keys;
+        vector<JsonKey> _slots;
+        size_t _bytes;
+
+        void Grow()
+        {
+            vector<JsonKey> slots(_slots.empty() ? 16u : _slots.size() * 2u);
+            auto mask = (uint32_t)slots.size() - 1u;
+            for (auto& key : _slots)
+            {
+                if (key.Text == nullptr)
+                    continue;
+                auto i = key.Hash & mask;
+                while (slots[i].Text != nullptr)
+                    i = (i + 1u) & mask;
+                slots[i] = key;
+            }
+            _slots.swap(slots);
+        }
+
     public:
-        vector<unique_ptr<JsonValue>> Elements;
-        JsonValueType GetType() const
+
+        JsonKeyTable() :
+            _bytes(0u)
         {
-            return JsonValueType::Array;
+            Grow();
+        }
+
+        static inline uint32_t Hash(const uint8* data, uint length)
+        {
+            auto h = 2166136261u;
+            for (auto i = 0u; i < length; i++)
+                h = (h ^ data[i]) * 16777619u;
+            return h;
+        }
+
+        auto Intern(const uint8* data, uint length) -> JsonKey
+        {
+            auto hash = Hash(data, length);
+            auto mask = (uint32_t)_slots.size() - 1u;
+            auto i = hash & mask;
+            for (; _slots[i].Text != nullptr; i = (i + 1u) & mask)
+            {
+                auto& key = _slots[i];
+                if (key.Hash == hash && key.Text->length() == length && memcmp(key.Text->data(), data, length) == 0)
+                    return key;
+            }
+            _keys.push_back(string((const char*)data, length));
+            _bytes += length;
+            JsonKey key(&_keys.back(), hash);
+            _slots[i] = key;
+            if (_keys.size() * 2u > _slots.size())
+                Grow();
+            return key;
+        }
+
+        inline auto Intern(const string& text) -> JsonKey
+        {
+            return Intern((const uint8*)text.data(), (uint)text.length());
+        }
+
+        // This table's key for the text of key, which may come from another
+        // table. A key from this table is returned after one probe.
+        auto Intern(const JsonKey& key) -> JsonKey
+        {
+            assert(key.Text != nullptr);
+            auto mask = (uint32_t)_slots.size() - 1u;
+            for (auto i = key.Hash & mask; _slots[i].Text != nullptr; i = (i + 1u) & mask)
+            {
+                if (_slots[i].Text == key.Text)
+                    return key;
+            }
+            return Intern(*key.Text);
+        }
+
+        inline auto GetCount() const -> uint
+        {
+            return (uint)_keys.size();
+        }
+
+        // Bytes of key text stored.
+        inline auto GetBytes() const -> size_t
+        {
+            return _bytes;
         }
     };
 
+    struct JsonMember
+    {
+        JsonKey Key;
+        unique_ptr<JsonValue> Value;
 
+        JsonMember(JsonKey key, unique_ptr<JsonValue> value) :
+            Key(key), Value(move(value))
+        {
 
+        }
+    };
 
+    // Members are kept in insertion order in a flat array, searched linearly
+    // until the object grows past IndexThreshold members and through an
+    // open-addressed index after that.
+    class JsonObject : 
+        public JsonValue
+    {
+    private:
+
+        static const uint IndexThreshold = 8u;
+        static const uint NotFound = ~0u;
+
+        shared_ptr<JsonKeyTable> _keys;
+        vector<JsonMember> _members;
+        // Member position + 1 for each slot, 0 for an empty slot.
+        vector<uint> _index;
+
+        void AddToIndex(uint member)
+        {
+            auto mask = (uint32_t)_index.size() - 1u;
+            auto i = _members[member].Key.Hash & mask;
+            while (_index[i] != 0u)
+                i = (i + 1u) & mask;
+            _index[i] = member + 1u;
+        }
+
+        void BuildIndex()
+        {
+            auto size = 16u;
+            while (size < _members.size() * 2u)
+                size <<= 1;
+            _index.assign(size, 0u);
+            for (auto i = 0u; i < _members.size(); i++)
+                AddToIndex(i);
+        }
+
+        auto FindMember(const JsonKey& key) const -> uint
+        {
+            if (key.Text == nullptr)
+                return NotFound;
+            if (_index.empty())
+            {
+                for (auto i = 0u; i < _members.size(); i++)
+                {
+                    if (_members[i].Key == key)
+                        return i;
+                }
+                return NotFound;
+            }
+            auto mask = (uint32_t)_index.size() - 1u;
+            for (auto i = key.Hash & mask; _index[i] != 0u; i = (i + 1u) & mask)
+            {
+                if (_members[_index[i] - 1u].Key == key)
+                    return _index[i] - 1u;
+            }
+            return NotFound;
+        }
+
+    public:
+
+        JsonObject()
+        {
 
+        }
 
+        explicit JsonObject(shared_ptr<JsonKeyTable> keys) :
+            _keys(move(keys))
+        {
+
+        }
+
+        // The table this object's keys are interned in, created on first use.
+        auto GetKeys() -> const shared_ptr<JsonKeyTable>&
+        {
+            if (!_keys)
+                _keys = make_shared<JsonKeyTable>();
+            return _keys;
+        }
+
+        inline auto Key(const string& name) -> JsonKey
+        {
+            return GetKeys()->Intern(name);
+        }
 
+        // Adds a member, replacing the value of an equal key. A key from
+        // another table is interned into this object's table first.
+        void Set(const JsonKey& other, unique_ptr<JsonValue> value)
+        {
+            auto key = GetKeys()->Intern(other);
+            auto found = FindMember(key);
+            if (found != NotFound)
+            {
+                _members[found].Value = move(value);
+                return;
+            }
+            _members.push_back(JsonMember(key, move(value)));
+            if (!_index.empty() && _members.size() * 2u <= _index.size())
+                AddToIndex((uint)_members.size() - 1u);
+            else if (_members.size() > IndexThreshold)
+                BuildIndex();
+        }
 
+        inline void Set(const string& name, unique_ptr<JsonValue> value)
+        {
+            Set(Key(name), move(value));
+        }
 
+        auto Find(const JsonKey& key) const -> JsonValue*
+        {
+            auto found = FindMember(key);
+            return found != NotFound ? _members[found].Value.get() : nullptr;
+        }
 
+        inline auto Find(const string& name) const -> JsonValue*
+        {
+            return Find(JsonKey(&name, JsonKeyTable::Hash((const uint8*)name.data(), (uint)name.length())));
+        }
 
+        inline auto GetMembers() const -> const vector<JsonMember>&
+        {
+            return _members;
+        }
 
+        inline auto GetCount() const -> uint
+        {
+            return (uint)_members.size();
+        }
 
+        JsonValueType GetType() const
+        {
+            return JsonValueType::Object;
+        }
+    };
 
-    auto Parse(string text) -> JsonValue*
+    class JsonArray : 
+        public JsonValue
     {
-        return nullptr;
-    }
+    public:
+        vector<unique_ptr<JsonValue>> Elements;
+        JsonValueType GetType() const
+        {
+            return JsonValueType::Array;
+        }
+    };
 }
\ No newline at end of file
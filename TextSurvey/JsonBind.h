@@ -0,0 +1,361 @@
+#pragma once
+
+#include "JsonScanner.h"
+#include <array>
+#include <type_traits>
+#include <limits>
+#include <tuple>
+#include <utility>
+
+namespace Json
+{
+    // Binds a JSON member name to a data member of T.
+    template<typename T, typename M>
+    struct JsonField
+    {
+        const char* Name;
+        M T::* Member;
+    };
+
+    template<typename T, typename M>
+    inline constexpr JsonField<T, M> Field(const char* name, M T::* member)
+    {
+        JsonField<T, M> field = { name, member };
+        return field;
+    }
+
+    // Specialize for each bound struct:
+    //
+    //     template<> struct JsonSchema<User>
+    //     {
+    //         static constexpr auto Fields() -> decltype(make_tuple(Field("id", &User::Id), Field("name", &User::Name)))
+    //         {
+    //             return make_tuple(Field("id", &User::Id), Field("name", &User::Name));
+    //         }
+    //     };
+    //
+    // Fields must be constexpr: the key lookup table is built from it at
+    // compile time, and two fields with the same name do not compile.
+    // Members may be bool, numbers, string, vector<M>, Option<M> (null is
+    // None) or another struct with a schema.
+    template<typename T>
+    struct JsonSchema;
+
+    template<typename T, typename Enable = void>
+    struct JsonReader;
+
+    namespace Binding
+    {
+        template<typename C>
+        inline constexpr uint32_t Hash(const C* data, uint length, uint32_t seed)
+        {
+            auto h = 2166136261u ^ seed;
+            for (auto i = 0u; i < length; i++)
+                h = (h ^ (uint8)data[i]) * 16777619u;
+            return h ^ (h >> 15);
+        }
+
+        inline constexpr uint NameLength(const char* name)
+        {
+            auto length = 0u;
+            while (name[length] != 0)
+                length++;
+            return length;
+        }
+
+        inline constexpr uint MinTableSize(uint count)
+        {
+            auto size = 1u;
+            while (size < count * 2u)
+                size <<= 1;
+            return size;
+        }
+
+        template<typename T>
+        inline constexpr uint FieldCount()
+        {
+            return (uint)tuple_size<decltype(JsonSchema<T>::Fields())>::value;
+        }
+
+        // The field names of a schema and a collision-free slot table over
+        // them: Slots holds a field index plus one, or 0 for an empty slot.
+        template<uint Count, uint MaxSize>
+        struct FieldLayout
+        {
+            bool Unique;
+            bool Found;
+            uint32_t Seed;
+            uint Size;
+            const char* Names[Count + 1u];
+            uint Lengths[Count + 1u];
+            uint Slots[MaxSize];
+        };
+
+        // Tries seeds for the smallest table first, then larger tables.
+        template<typename T, uint Count, uint MaxSize, size_t... I>
+        inline constexpr auto PlanFields(index_sequence<I...>) -> FieldLayout<Count, MaxSize>
+        {
+            FieldLayout<Count, MaxSize> layout = {};
+            const char* names[] = { get<I>(JsonSchema<T>::Fields()).Name..., nullptr };
+            layout.Unique = true;
+            for (auto i = 0u; i < Count; i++)
+            {
+                layout.Names[i] = names[i];
+                layout.Lengths[i] = NameLength(names[i]);
+                for (auto j = 0u; j < i; j++)
+                {
+                    auto same = layout.Lengths[i] == layout.Lengths[j];
+                    for (auto k = 0u; same && k < layout.Lengths[i]; k++)
+                        same = names[i][k] == names[j][k];
+                    if (same)
+                        layout.Unique = false;
+                }
+            }
+            if (!layout.Unique)
+                return layout;
+            for (auto size = MinTableSize(Count); size <= MaxSize; size <<= 1)
+            {
+                for (auto seed = 0u; seed < 1024u; seed++)
+                {
+                    for (auto i = 0u; i < size; i++)
+                        layout.Slots[i] = 0u;
+                    auto collision = false;
+                    for (auto i = 0u; i < Count && !collision; i++)
+                    {
+                        auto& slot = layout.Slots[Hash(names[i], layout.Lengths[i], seed) & (size - 1u)];
+                        collision = slot != 0u;
+                        slot = i + 1u;
+                    }
+                    if (!collision)
+                    {
+                        layout.Found = true;
+                        layout.Seed = seed;
+                        layout.Size = size;
+                        return layout;
+                    }
+                }
+            }
+            return layout;
+        }
+
+        template<typename T, size_t I>
+        bool ReadField(JsonScanner& scanner, T& value)
+        {
+            constexpr auto field = get<I>(JsonSchema<T>::Fields());
+            return JsonReader<typename remove_reference<decltype(value.*field.Member)>::type>::Read(scanner, value.*field.Member);
+        }
+
+        template<typename T, size_t... I>
+        inline constexpr auto MakeReaders(index_sequence<I...>) -> array<bool (*)(JsonScanner&, T&), sizeof...(I) + 1u>
+        {
+            return {{ &ReadField<T, I>..., nullptr }};
+        }
+
+        // Perfect hash over the field names of T, laid out at compile time.
+        // Keys that miss it are unknown and get skipped.
+        template<typename T>
+        class FieldTable
+        {
+        private:
+
+            typedef bool (*Reader)(JsonScanner&, T&);
+
+            static constexpr uint Count = FieldCount<T>();
+            static constexpr uint MaxSize = MinTableSize(Count) << 3;
+            static constexpr FieldLayout<Count, MaxSize> Layout = PlanFields<T, Count, MaxSize>(make_index_sequence<Count>());
+            static constexpr array<Reader, Count + 1u> Readers = MakeReaders<T>(make_index_sequence<Count>());
+
+            static_assert(Layout.Unique, "JsonSchema has two fields with the same name");
+            static_assert(Layout.Found, "No collision-free FieldTable for this JsonSchema");
+
+        public:
+
+            static auto Find(const uint8* key, uint length) -> Reader
+            {
+                auto slot = Layout.Slots[Hash(key, length, Layout.Seed) & (Layout.Size - 1u)];
+                if (slot == 0u)
+                    return nullptr;
+                auto i = slot - 1u;
+                if (Layout.Lengths[i] != length || memcmp(Layout.Names[i], key, length) != 0)
+                    return nullptr;
+                return Readers[i];
+            }
+        };
+
+        // Reads an integer as sign and magnitude. Fails on fractions,
+        // exponents and magnitudes that do not fit in uint64_t.
+        inline bool ReadInteger(JsonScanner& scanner, uint64_t& magnitude, bool& negative)
+        {
+            uint start, length;
+            if (!scanner.ReadNumberSpan(start, length))
+                return false;
+            auto data = scanner.GetData() + start;
+            negative = data[0] == '-';
+            magnitude = 0u;
+            for (auto i = negative ? 1u : 0u; i < length; i++)
+            {
+                if (data[i] < '0' || data[i] > '9')
+                    return false;
+                auto digit = (uint64_t)(data[i] - '0');
+                if (magnitude > (numeric_limits<uint64_t>::max() - digit) / 10u)
+                    return false;
+                magnitude = magnitude * 10u + digit;
+            }
+            return true;
+        }
+    }
+
+    // Structs with a JsonSchema.
+    template<typename T, typename Enable>
+    struct JsonReader
+    {
+        static bool Read(JsonScanner& scanner, T& value)
+        {
+            if (!scanner.Consume('{'))
+                return false;
+            if (scanner.Consume('}'))
+                return true;
+            string key;
+            do
+            {
+                uint start, length;
+                bool escaped;
+                if (!scanner.ReadStringSpan(start, length, escaped) || !scanner.Consume(':'))
+                    return false;
+                auto name = scanner.GetData() + start;
+                if (escaped)
+                {
+                    if (!JsonScanner::Unescape(name, length, key))
+                        return false;
+                    name = (const uint8*)key.data();
+                    length = (uint)key.length();
+                }
+                auto read = Binding::FieldTable<T>::Find(name, length);
+                if (!(read != nullptr ? read(scanner, value) : scanner.SkipValue()))
+                    return false;
+            }
+            while (scanner.Consume(','));
+            return scanner.Consume('}');
+        }
+    };
+
+    template<>
+    struct JsonReader<bool>
+    {
+        static bool Read(JsonScanner& scanner, bool& value)
+        {
+            auto c = scanner.Peek();
+            value = c == 't';
+            return c == 't' ? scanner.ConsumeLiteral("true", 4u) : scanner.ConsumeLiteral("false", 5u);
+        }
+    };
+
+    template<typename T>
+    struct JsonReader<T, typename enable_if<is_integral<T>::value && !is_same<T, bool>::value>::type>
+    {
+        // Fails rather than truncate values outside the range of T.
+        static bool Read(JsonScanner& scanner, T& value)
+        {
+            uint64_t magnitude;
+            bool negative;
+            if (!Binding::ReadInteger(scanner, magnitude, negative))
+                return false;
+            if (negative && magnitude != 0u)
+            {
+                if (!is_signed<T>::value || magnitude - 1u > (uint64_t)numeric_limits<T>::max())
+                    return false;
+                value = (T)(-(int64_t)(magnitude - 1u) - 1);
+                return true;
+            }
+            if (magnitude > (uint64_t)numeric_limits<T>::max())
+                return false;
+            value = (T)magnitude;
+            return true;
+        }
+    };
+
+    template<typename T>
+    struct JsonReader<T, typename enable_if<is_floating_point<T>::value>::type>
+    {
+        static bool Read(JsonScanner& scanner, T& value)
+        {
+            double n;
+            if (!scanner.ReadNumber(n))
+                return false;
+            value = (T)n;
+            return true;
+        }
+    };
+
+    template<>
+    struct JsonReader<string>
+    {
+        static bool Read(JsonScanner& scanner, string& value)
+        {
+            return scanner.ReadString(value);
+        }
+    };
+
+    template<typename T>
+    struct JsonReader<vector<T>>
+    {
+        static bool Read(JsonScanner& scanner, vector<T>& value)
+        {
+            value.clear();
+            if (!scanner.Consume('['))
+                return false;
+            if (scanner.Consume(']'))
+                return true;
+            do
+            {
+                value.push_back(T());
+                if (!JsonReader<T>::Read(scanner, value.back()))
+                    return false;
+            }
+            while (scanner.Consume(','));
+            return scanner.Consume(']');
+        }
+    };
+
+    template<typename T>
+    struct JsonReader<TextSurvey::Option<T>>
+    {
+        static bool Read(JsonScanner& scanner, TextSurvey::Option<T>& value)
+        {
+            if (scanner.Peek() == 'n')
+            {
+                value = TextSurvey::None<T>();
+                return scanner.ConsumeLiteral("null", 4u);
+            }
+            T item = T();
+            if (!JsonReader<T>::Read(scanner, item))
+                return false;
+            value = TextSurvey::Some(item);
+            return true;
+        }
+    };
+
+    // Parses JSON straight into value without building JsonValue nodes.
+    // Members missing from the input keep their current values.
+    template<typename T>
+    bool Deserialize(const uint8* data, uint length, T& value)
+    {
+        JsonScanner scanner(data, length);
+        if (!JsonReader<T>::Read(scanner, value))
+            return false;
+        scanner.SkipWhitespace();
+        return scanner.AtEnd();
+    }
+
+    template<typename T>
+    bool Deserialize(const string& text, T& value)
+    {
+        return Deserialize((const uint8*)text.data(), (uint)text.length(), value);
+    }
+
+    template<typename T>
+    bool Deserialize(TextSurvey::TextStream& stream, T& value)
+    {
+        return Deserialize(stream.GetData(), stream.GetLength(), value);
+    }
+}
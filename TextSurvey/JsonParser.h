@@ -0,0 +1,139 @@
+#pragma once
+
+#include "JsonScanner.h"
+
+namespace Json
+{
+    namespace Parsing
+    {
+        const uint MaxDepth = 512u;
+        // A thread's default table is replaced once it holds this many keys
+        // or key bytes, which bounds what each live document keeps alive.
+        const uint MaxSharedKeys = 1024u;
+        const size_t MaxSharedKeyBytes = 16u * 1024u;
+
+        inline auto DefaultKeys() -> const shared_ptr<JsonKeyTable>&
+        {
+            static thread_local shared_ptr<JsonKeyTable> keys;
+            if (!keys || keys->GetCount() >= MaxSharedKeys || keys->GetBytes() >= MaxSharedKeyBytes)
+                keys = make_shared<JsonKeyTable>();
+            return keys;
+        }
+
+        inline auto ReadValue(JsonScanner& scanner, uint depth, const shared_ptr<JsonKeyTable>& keys) -> unique_ptr<JsonValue>
+        {
+            if (depth > MaxDepth)
+                return nullptr;
+            switch (scanner.Peek())
+            {
+            case '{':
+                {
+                    scanner.Consume('{');
+                    unique_ptr<JsonObject> object(new JsonObject(keys));
+                    if (scanner.Consume('}'))
+                        return object;
+                    string text;
+                    do
+                    {
+                        uint start, length;
+                        bool escaped;
+                        if (!scanner.ReadStringSpan(start, length, escaped))
+                            return nullptr;
+                        JsonKey key;
+                        if (!escaped)
+                            key = keys->Intern(scanner.GetData() + start, length);
+                        else if (JsonScanner::Unescape(scanner.GetData() + start, length, text))
+                            key = keys->Intern(text);
+                        else
+                            return nullptr;
+                        if (!scanner.Consume(':'))
+                            return nullptr;
+                        auto value = ReadValue(scanner, depth + 1u, keys);
+                        if (!value)
+                            return nullptr;
+                        object->Set(key, move(value));
+                    }
+                    while (scanner.Consume(','));
+                    if (!scanner.Consume('}'))
+                        return nullptr;
+                    return object;
+                }
+            case '[':
+                {
+                    scanner.Consume('[');
+                    unique_ptr<JsonArray> array(new JsonArray());
+                    if (scanner.Consume(']'))
+                        return array;
+                    do
+                    {
+                        auto value = ReadValue(scanner, depth + 1u, keys);
+                        if (!value)
+                            return nullptr;
+                        array->Elements.push_back(move(value));
+                    }
+                    while (scanner.Consume(','));
+                    if (!scanner.Consume(']'))
+                        return nullptr;
+                    return array;
+                }
+            case '"':
+                {
+                    unique_ptr<JsonString> text(new JsonString());
+                    if (!scanner.ReadString(text->Value))
+                        return nullptr;
+                    return text;
+                }
+            case 't':
+            case 'f':
+                {
+                    unique_ptr<JsonBoolean> boolean(new JsonBoolean());
+                    boolean->Value = scanner.Peek() == 't';
+                    if (!(boolean->Value ? scanner.ConsumeLiteral("true", 4u) : scanner.ConsumeLiteral("false", 5u)))
+                        return nullptr;
+                    return boolean;
+                }
+            case 'n':
+                if (!scanner.ConsumeLiteral("null", 4u))
+                    return nullptr;
+                return unique_ptr<JsonValue>(new JsonNull());
+            default:
+                {
+                    unique_ptr<JsonNumber> number(new JsonNumber());
+                    if (!scanner.ReadNumber(number->Value))
+                        return nullptr;
+                    return number;
+                }
+            }
+        }
+    }
+
+    // Parses one JSON document into a tree owned by the caller. Returns
+    // nullptr when the text is malformed; errorOffset, when given, receives
+    // the byte offset where reading stopped. Object keys are interned in
+    // keys, or when keys is null in a small table shared by the documents
+    // this thread parses, so repeated keys are stored once. Every object
+    // keeps its table alive. New keys may only be added to objects of a
+    // default-table document on the thread that parsed it; pass keys to
+    // modify documents elsewhere.
+    inline auto Parse(const uint8* data, uint length, uint* errorOffset = nullptr, shared_ptr<JsonKeyTable> keys = nullptr) -> JsonValue*
+    {
+        if (!keys)
+            keys = Parsing::DefaultKeys();
+        JsonScanner scanner(data, length);
+        auto value = Parsing::ReadValue(scanner, 0u, keys);
+        if (value)
+        {
+            scanner.SkipWhitespace();
+            if (!scanner.AtEnd())
+                value.reset();
+        }
+        if (errorOffset != nullptr)
+            *errorOffset = value ? length : scanner.GetOffset();
+        return value.release();
+    }
+
+    inline auto Parse(const string& text, uint* errorOffset = nullptr, shared_ptr<JsonKeyTable> keys = nullptr) -> JsonValue*
+    {
+        return Parse((const uint8*)text.data(), (uint)text.length(), errorOffset, move(keys));
+    }
+}
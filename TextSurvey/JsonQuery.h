@@ -0,0 +1,340 @@
+#pragma once
+
+#include "JsonScanner.h"
+
+namespace Json
+{
+    // A value selected by a query path. Offset and Length cover the raw
+    // bytes of the value in the input.
+    struct JsonMatch
+    {
+        uint Path;
+        uint Offset;
+        uint Length;
+
+        JsonMatch(uint path, uint offset, uint length) :
+            Path(path), Offset(offset), Length(length)
+        {
+
+        }
+
+        inline string GetText(const uint8* data) const
+        {
+            return string((const char*)data + Offset, Length);
+        }
+
+        inline bool GetString(const uint8* data, string& value) const
+        {
+            JsonScanner scanner(data, Offset + Length, Offset);
+            return scanner.ReadString(value);
+        }
+
+        inline bool GetNumber(const uint8* data, double& value) const
+        {
+            JsonScanner scanner(data, Offset + Length, Offset);
+            return scanner.ReadNumber(value);
+        }
+    };
+
+    // Compiles JSONPath ($.a[*].b, $['a'][0]) and JSON Pointer (/a/b/0)
+    // expressions into one trie so any number of paths are evaluated in a
+    // single pass. Values no path can reach are skipped without decoding.
+    class JsonQuery
+    {
+    private:
+
+        static const uint None = 0xFFFFFFFFu;
+
+        struct Node
+        {
+            vector<pair<string, uint>> Keys;
+            vector<pair<uint, uint>> Indexes;
+            uint Wildcard;
+            vector<uint> Accepts;
+
+            Node() :
+                Wildcard(None)
+            {
+
+            }
+
+            inline bool IsLeaf() const
+            {
+                return Keys.empty() && Indexes.empty() && Wildcard == None;
+            }
+        };
+
+        vector<Node> _nodes;
+        uint _pathCount;
+
+        vector<uint> _active;
+        vector<JsonMatch>* _matches;
+        string _key;
+
+        auto AddNode() -> uint
+        {
+            _nodes.push_back(Node());
+            return (uint)_nodes.size() - 1u;
+        }
+
+        auto KeyStep(uint node, const string& key) -> uint
+        {
+            for (auto& p : _nodes[node].Keys)
+                if (p.first == key)
+                    return p.second;
+            auto next = AddNode();
+            _nodes[node].Keys.push_back(make_pair(key, next));
+            return next;
+        }
+
+        auto IndexStep(uint node, uint index, uint next = None) -> uint
+        {
+            for (auto& p : _nodes[node].Indexes)
+                if (p.first == index)
+                    return p.second;
+            if (next == None)
+                next = AddNode();
+            _nodes[node].Indexes.push_back(make_pair(index, next));
+            return next;
+        }
+
+        auto WildcardStep(uint node) -> uint
+        {
+            if (_nodes[node].Wildcard == None)
+            {
+                auto next = AddNode();
+                _nodes[node].Wildcard = next;
+            }
+            return _nodes[node].Wildcard;
+        }
+
+        static bool ParseIndex(const string& text, uint& index)
+        {
+            if (text.empty() || text.length() > 9u || (text[0] == '0' && text.length() > 1u))
+                return false;
+            index = 0u;
+            for (auto c : text)
+            {
+                if (c < '0' || c > '9')
+                    return false;
+                index = index * 10u + (uint)(c - '0');
+            }
+            return true;
+        }
+
+        auto CompilePointer(const string& path) -> uint
+        {
+            auto node = 0u;
+            auto i = 0u;
+            while (i < path.length())
+            {
+                if (path[i] != '/')
+                    return None;
+                string token;
+                for (i++; i < path.length() && path[i] != '/'; i++)
+                {
+                    if (path[i] != '~')
+                    {
+                        token += path[i];
+                        continue;
+                    }
+                    if (++i >= path.length() || (path[i] != '0' && path[i] != '1'))
+                        return None;
+                    token += path[i] == '0' ? '~' : '/';
+                }
+                uint index;
+                auto next = KeyStep(node, token);
+                if (ParseIndex(token, index))
+                    IndexStep(node, index, next);
+                node = next;
+            }
+            return node;
+        }
+
+        auto CompilePath(const string& path) -> uint
+        {
+            if (path.empty() || path[0] != '$')
+                return None;
+            auto node = 0u;
+            auto i = 1u;
+            while (i < path.length())
+            {
+                if (path[i] == '.')
+                {
+                    auto start = ++i;
+                    if (i < path.length() && path[i] == '*')
+                    {
+                        node = WildcardStep(node);
+                        i++;
+                        continue;
+                    }
+                    while (i < path.length() && path[i] != '.' && path[i] != '[')
+                        i++;
+                    if (i == start)
+                        return None;
+                    node = KeyStep(node, path.substr(start, i - start));
+                }
+                else if (path[i] == '[')
+                {
+                    auto close = path.find(']', i);
+                    if (close == string::npos)
+                        return None;
+                    auto inner = path.substr(i + 1u, close - i - 1u);
+                    uint index;
+                    if (inner == "*")
+                        node = WildcardStep(node);
+                    else if (ParseIndex(inner, index))
+                        node = IndexStep(node, index);
+                    else if (inner.length() >= 2u && (inner[0] == '\'' || inner[0] == '"') && inner.back() == inner[0])
+                        node = KeyStep(node, inner.substr(1u, inner.length() - 2u));
+                    else
+                        return None;
+                    i = (uint)close + 1u;
+                }
+                else
+                {
+                    return None;
+                }
+            }
+            return node;
+        }
+
+        bool KeyEquals(const string& key, const uint8* data, uint start, uint length, bool escaped)
+        {
+            if (!escaped)
+                return key.length() == length && memcmp(key.data(), data + start, length) == 0;
+            return JsonScanner::Unescape(data + start, length, _key) && _key == key;
+        }
+
+        bool Visit(JsonScanner& scanner, uint first, uint last)
+        {
+            auto c = scanner.Peek();
+            auto start = scanner.GetOffset();
+            auto firstMatch = _matches->size();
+            auto descend = false;
+            for (auto i = first; i < last; i++)
+            {
+                auto& node = _nodes[_active[i]];
+                for (auto path : node.Accepts)
+                    _matches->push_back(JsonMatch(path, start, 0u));
+                descend = descend || !node.IsLeaf();
+            }
+            auto lastMatch = _matches->size();
+
+            auto ok = true;
+            if (!descend || (c != '{' && c != '['))
+                ok = scanner.SkipValue();
+            else if (c == '{')
+                ok = VisitObject(scanner, first, last);
+            else
+                ok = VisitArray(scanner, first, last);
+
+            for (auto i = firstMatch; i < lastMatch; i++)
+                (*_matches)[i].Length = scanner.GetOffset() - start;
+            return ok;
+        }
+
+        bool VisitObject(JsonScanner& scanner, uint first, uint last)
+        {
+            scanner.Consume('{');
+            if (scanner.Consume('}'))
+                return true;
+            auto data = scanner.GetData();
+            do
+            {
+                uint keyStart, keyLength;
+                bool escaped;
+                if (!scanner.ReadStringSpan(keyStart, keyLength, escaped) || !scanner.Consume(':'))
+                    return false;
+                auto next = (uint)_active.size();
+                for (auto i = first; i < last; i++)
+                {
+                    auto& node = _nodes[_active[i]];
+                    for (auto& p : node.Keys)
+                        if (KeyEquals(p.first, data, keyStart, keyLength, escaped))
+                            _active.push_back(p.second);
+                    if (node.Wildcard != None)
+                        _active.push_back(node.Wildcard);
+                }
+                auto end = (uint)_active.size();
+                auto ok = next == end ? scanner.SkipValue() : Visit(scanner, next, end);
+                _active.resize(next);
+                if (!ok)
+                    return false;
+            }
+            while (scanner.Consume(','));
+            return scanner.Consume('}');
+        }
+
+        bool VisitArray(JsonScanner& scanner, uint first, uint last)
+        {
+            scanner.Consume('[');
+            if (scanner.Consume(']'))
+                return true;
+            auto index = 0u;
+            do
+            {
+                auto next = (uint)_active.size();
+                for (auto i = first; i < last; i++)
+                {
+                    auto& node = _nodes[_active[i]];
+                    for (auto& p : node.Indexes)
+                        if (p.first == index)
+                            _active.push_back(p.second);
+                    if (node.Wildcard != None)
+                        _active.push_back(node.Wildcard);
+                }
+                auto end = (uint)_active.size();
+                auto ok = next == end ? scanner.SkipValue() : Visit(scanner, next, end);
+                _active.resize(next);
+                if (!ok)
+                    return false;
+                index++;
+            }
+            while (scanner.Consume(','));
+            return scanner.Consume(']');
+        }
+
+    public:
+
+        JsonQuery() :
+            _pathCount(0u), _matches(nullptr)
+        {
+            AddNode();
+        }
+
+        // Adds a JSONPath ("$...") or JSON Pointer ("" or "/...") expression
+        // and returns its path id, or -1 if the expression is not supported.
+        auto Add(const string& path) -> int
+        {
+            auto node = !path.empty() && path[0] == '$' ? CompilePath(path) : CompilePointer(path);
+            if (node == None)
+                return -1;
+            _nodes[node].Accepts.push_back(_pathCount);
+            return (int)_pathCount++;
+        }
+
+        inline uint GetPathCount() const
+        {
+            return _pathCount;
+        }
+
+        // Appends the matches of every path in document order. Returns false
+        // if the input is not a well formed value along the visited paths.
+        bool Run(const uint8* data, uint length, vector<JsonMatch>& matches)
+        {
+            JsonScanner scanner(data, length);
+            _matches = &matches;
+            _active.clear();
+            _active.push_back(0u);
+            auto ok = Visit(scanner, 0u, 1u);
+            _matches = nullptr;
+            return ok;
+        }
+
+        bool Run(TextSurvey::TextStream& stream, vector<JsonMatch>& matches)
+        {
+            return Run(stream.GetData(), stream.GetLength(), matches);
+        }
+    };
+}
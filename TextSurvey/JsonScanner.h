@@ -0,0 +1,416 @@
+#pragma once
+
+#include "Json.h"
+#include "Simd.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+namespace Json
+{
+    // Forward-only reader over raw JSON bytes. Values can be decoded or
+    // skipped; skipping only tracks strings and bracket depth.
+    class JsonScanner
+    {
+    private:
+
+        const uint8* _data;
+        uint _length;
+        uint _offset;
+
+        static inline bool IsDigit(uint8 c)
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        static inline int HexValue(uint8 c)
+        {
+            if (c >= '0' && c <= '9')
+                return c - '0';
+            if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+            return -1;
+        }
+
+        static void AppendUtf8(string& out, uint c)
+        {
+            if (c < 0x80)
+            {
+                out += (char)c;
+            }
+            else if (c < 0x800)
+            {
+                out += (char)(0xC0 | (c >> 6));
+                out += (char)(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                out += (char)(0xE0 | (c >> 12));
+                out += (char)(0x80 | ((c >> 6) & 0x3F));
+                out += (char)(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                out += (char)(0xF0 | (c >> 18));
+                out += (char)(0x80 | ((c >> 12) & 0x3F));
+                out += (char)(0x80 | ((c >> 6) & 0x3F));
+                out += (char)(0x80 | (c & 0x3F));
+            }
+        }
+
+        bool ReadHex4(uint& value)
+        {
+            if (_length - _offset < 4u)
+                return false;
+            value = 0u;
+            for (auto i = 0u; i < 4u; i++)
+            {
+                auto h = HexValue(_data[_offset++]);
+                if (h < 0)
+                    return false;
+                value = (value << 4) | (uint)h;
+            }
+            return true;
+        }
+
+        // Advances to the next '"' or '\\' at or after the current offset.
+        inline void FindQuoteOrEscape()
+        {
+            auto i = _offset;
+#if defined(TEXTSURVEY_SSE2)
+            auto quote = _mm_set1_epi8('"');
+            auto backslash = _mm_set1_epi8('\\');
+            for (; i + 16u <= _length; i += 16u)
+            {
+                auto block = _mm_loadu_si128((const __m128i*)(_data + i));
+                auto mask = (uint)_mm_movemask_epi8(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+                if (mask != 0u)
+                {
+                    _offset = i + TextSurvey::Simd::TrailingZeros(mask);
+                    return;
+                }
+            }
+#endif
+            while (i < _length && _data[i] != '"' && _data[i] != '\\')
+                i++;
+            _offset = i;
+        }
+
+        // Advances to the next quote or bracket at or after the current offset.
+        inline void FindStructural()
+        {
+            auto i = _offset;
+#if defined(TEXTSURVEY_SSE2)
+            auto quote = _mm_set1_epi8('"');
+            auto openBracket = _mm_set1_epi8('[');
+            auto closeBracket = _mm_set1_epi8(']');
+            auto openBrace = _mm_set1_epi8('{');
+            auto closeBrace = _mm_set1_epi8('}');
+            for (; i + 16u <= _length; i += 16u)
+            {
+                auto block = _mm_loadu_si128((const __m128i*)(_data + i));
+                auto special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, openBracket)),
+                    _mm_or_si128(
+                        _mm_or_si128(_mm_cmpeq_epi8(block, closeBracket), _mm_cmpeq_epi8(block, openBrace)),
+                        _mm_cmpeq_epi8(block, closeBrace)));
+                auto mask = (uint)_mm_movemask_epi8(special);
+                if (mask != 0u)
+                {
+                    _offset = i + TextSurvey::Simd::TrailingZeros(mask);
+                    return;
+                }
+            }
+#endif
+            for (; i < _length; i++)
+            {
+                auto c = _data[i];
+                if (c == '"' || c == '[' || c == ']' || c == '{' || c == '}')
+                    break;
+            }
+            _offset = i;
+        }
+
+    public:
+
+        JsonScanner(const uint8* data, uint length, uint offset = 0u) :
+            _data(data), _length(length), _offset(offset)
+        {
+
+        }
+
+        inline const uint8* GetData() const
+        {
+            return _data;
+        }
+
+        inline uint GetLength() const
+        {
+            return _length;
+        }
+
+        inline uint GetOffset() const
+        {
+            return _offset;
+        }
+
+        inline void SetOffset(uint offset)
+        {
+            _offset = offset;
+        }
+
+        inline bool AtEnd() const
+        {
+            return _offset >= _length;
+        }
+
+        inline void SkipWhitespace()
+        {
+            while (_offset < _length)
+            {
+                auto c = _data[_offset];
+                if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                    return;
+                _offset++;
+            }
+        }
+
+        // Returns the next significant byte without consuming it, or 0 at the end.
+        inline uint8 Peek()
+        {
+            SkipWhitespace();
+            return _offset < _length ? _data[_offset] : 0;
+        }
+
+        inline bool Consume(uint8 c)
+        {
+            if (Peek() != c)
+                return false;
+            _offset++;
+            return true;
+        }
+
+        bool ConsumeLiteral(const char* literal, uint length)
+        {
+            if (_length - _offset < length || memcmp(_data + _offset, literal, length) != 0)
+                return false;
+            _offset += length;
+            return true;
+        }
+
+        // Reads a string without decoding it. start and length cover the raw
+        // bytes between the quotes; escaped is set when they contain escapes.
+        bool ReadStringSpan(uint& start, uint& length, bool& escaped)
+        {
+            if (!Consume('"'))
+                return false;
+            start = _offset;
+            escaped = false;
+            for (;;)
+            {
+                FindQuoteOrEscape();
+                if (_offset >= _length)
+                    return false;
+                if (_data[_offset] == '"')
+                    break;
+                escaped = true;
+                _offset += 2u;
+            }
+            length = _offset - start;
+            _offset++;
+            return true;
+        }
+
+        inline bool SkipString()
+        {
+            uint start, length;
+            bool escaped;
+            return ReadStringSpan(start, length, escaped);
+        }
+
+        // Decodes the raw bytes of a string body (as given by ReadStringSpan).
+        static bool Unescape(const uint8* data, uint length, string& out)
+        {
+            out.clear();
+            out.reserve(length);
+            JsonScanner scanner(data, length);
+            auto start = 0u;
+            auto& i = scanner._offset;
+            while (i < length)
+            {
+                if (data[i] != '\\')
+                {
+                    i++;
+                    continue;
+                }
+                out.append((const char*)data + start, i - start);
+                if (++i >= length)
+                    return false;
+                auto c = data[i++];
+                switch (c)
+                {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                    {
+                        uint code;
+                        if (!scanner.ReadHex4(code))
+                            return false;
+                        if (code >= 0xD800 && code < 0xDC00)
+                        {
+                            uint low;
+                            if (i + 2u > length || data[i] != '\\' || data[i + 1u] != 'u')
+                                return false;
+                            i += 2u;
+                            if (!scanner.ReadHex4(low) || low < 0xDC00 || low >= 0xE000)
+                                return false;
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        AppendUtf8(out, code);
+                    }
+                    break;
+                default:
+                    return false;
+                }
+                start = i;
+            }
+            out.append((const char*)data + start, length - start);
+            return true;
+        }
+
+        bool ReadString(string& out)
+        {
+            uint start, length;
+            bool escaped;
+            if (!ReadStringSpan(start, length, escaped))
+                return false;
+            if (!escaped)
+            {
+                out.assign((const char*)_data + start, length);
+                return true;
+            }
+            return Unescape(_data + start, length, out);
+        }
+
+        // Reads a number without converting it.
+        bool ReadNumberSpan(uint& start, uint& length)
+        {
+            SkipWhitespace();
+            start = _offset;
+            auto i = _offset;
+            if (i < _length && _data[i] == '-')
+                i++;
+            if (i >= _length || !IsDigit(_data[i]))
+                return false;
+            if (_data[i] == '0')
+                i++;
+            else
+                while (i < _length && IsDigit(_data[i]))
+                    i++;
+            if (i < _length && _data[i] == '.')
+            {
+                if (++i >= _length || !IsDigit(_data[i]))
+                    return false;
+                while (i < _length && IsDigit(_data[i]))
+                    i++;
+            }
+            if (i < _length && (_data[i] == 'e' || _data[i] == 'E'))
+            {
+                i++;
+                if (i < _length && (_data[i] == '+' || _data[i] == '-'))
+                    i++;
+                if (i >= _length || !IsDigit(_data[i]))
+                    return false;
+                while (i < _length && IsDigit(_data[i]))
+                    i++;
+            }
+            length = i - start;
+            _offset = i;
+            return true;
+        }
+
+        static bool ConvertNumber(const uint8* data, uint length, double& value)
+        {
+#if defined(__cpp_lib_to_chars)
+            auto result = from_chars((const char*)data, (const char*)data + length, value);
+            return result.ec == errc() || result.ec == errc::result_out_of_range;
+#else
+            char buffer[64];
+            if (length < sizeof(buffer))
+            {
+                memcpy(buffer, data, length);
+                buffer[length] = 0;
+                value = strtod(buffer, nullptr);
+                return true;
+            }
+            string text((const char*)data, length);
+            value = strtod(text.c_str(), nullptr);
+            return true;
+#endif
+        }
+
+        bool ReadNumber(double& value)
+        {
+            uint start, length;
+            return ReadNumberSpan(start, length) && ConvertNumber(_data + start, length, value);
+        }
+
+        // Skips one complete value of any type.
+        bool SkipValue()
+        {
+            switch (Peek())
+            {
+            case '"':
+                return SkipString();
+            case '{':
+            case '[':
+                {
+                    auto depth = 0u;
+                    for (;;)
+                    {
+                        FindStructural();
+                        if (_offset >= _length)
+                            return false;
+                        auto c = _data[_offset];
+                        if (c == '"')
+                        {
+                            if (!SkipString())
+                                return false;
+                            continue;
+                        }
+                        _offset++;
+                        if (c == '{' || c == '[')
+                            depth++;
+                        else if (--depth == 0u)
+                            return true;
+                    }
+                }
+            case 't':
+                return ConsumeLiteral("true", 4u);
+            case 'f':
+                return ConsumeLiteral("false", 5u);
+            case 'n':
+                return ConsumeLiteral("null", 4u);
+            default:
+                {
+                    uint start, length;
+                    return ReadNumberSpan(start, length);
+                }
+            }
+        }
+    };
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "Json.h"
+#include "Simd.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace Json
+{
+    struct JsonWriteOptions
+    {
+        bool Pretty;
+        uint Indent;
+
+        JsonWriteOptions() :
+            Pretty(false), Indent(2u)
+        {
+
+        }
+
+        JsonWriteOptions(bool pretty, uint indent = 2u) :
+            Pretty(pretty), Indent(indent)
+        {
+
+        }
+    };
+
+    // Growable in-memory sink.
+    class JsonBuffer
+    {
+    private:
+
+        vector<char> _data;
+        size_t _length;
+
+    public:
+
+        JsonBuffer(size_t capacity = 4096u) :
+            _data(capacity), _length(0u)
+        {
+
+        }
+
+        inline char* Reserve(size_t count)
+        {
+            if (_length + count > _data.size())
+                _data.resize(max(_data.size() * 2u, _length + count));
+            return &_data[0] + _length;
+        }
+
+        inline void Commit(size_t count)
+        {
+            _length += count;
+        }
+
+        inline void Write(const char* data, size_t count)
+        {
+            memcpy(Reserve(count), data, count);
+            _length += count;
+        }
+
+        inline void Put(char c)
+        {
+            *Reserve(1u) = c;
+            _length++;
+        }
+
+        inline const char* GetData() const
+        {
+            return _data.data();
+        }
+
+        inline size_t GetLength() const
+        {
+            return _length;
+        }
+
+        inline string ToString() const
+        {
+            return string(_data.data(), _length);
+        }
+
+        inline void Clear()
+        {
+            _length = 0u;
+        }
+    };
+
+    // Buffers output and writes it to a file descriptor in large blocks.
+    class JsonFileSink
+    {
+    private:
+
+        static const size_t Capacity = 1u << 16;
+
+        int _fd;
+        size_t _length;
+        bool _failed;
+        char _buffer[Capacity];
+
+        JsonFileSink(const JsonFileSink&);
+        JsonFileSink& operator=(const JsonFileSink&);
+
+    public:
+
+        JsonFileSink(int fd) :
+            _fd(fd), _length(0u), _failed(false)
+        {
+
+        }
+
+        ~JsonFileSink()
+        {
+            Flush();
+        }
+
+        void Flush()
+        {
+            auto p = _buffer;
+            while (_length > 0u && !_failed)
+            {
+#if defined(_WIN32)
+                auto written = _write(_fd, p, (unsigned int)_length);
+#else
+                auto written = write(_fd, p, _length);
+#endif
+                if (written <= 0)
+                {
+                    _failed = true;
+                    break;
+                }
+                p += written;
+                _length -= (size_t)written;
+            }
+            _length = 0u;
+        }
+
+        inline char* Reserve(size_t count)
+        {
+            assert(count <= Capacity);
+            if (_length + count > Capacity)
+                Flush();
+            return _buffer + _length;
+        }
+
+        inline void Commit(size_t count)
+        {
+            _length += count;
+        }
+
+        inline void Write(const char* data, size_t count)
+        {
+            while (count > 0u)
+            {
+                if (_length == Capacity)
+                    Flush();
+                auto n = min(count, Capacity - _length);
+                memcpy(_buffer + _length, data, n);
+                _length += n;
+                data += n;
+                count -= n;
+            }
+        }
+
+        inline void Put(char c)
+        {
+            if (_length == Capacity)
+                Flush();
+            _buffer[_length++] = c;
+        }
+
+        inline bool HasFailed() const
+        {
+            return _failed;
+        }
+    };
+
+    // Writes the shortest decimal that parses back to the same double and
+    // returns its length. buffer must hold at least 32 chars.
+    inline uint FormatDouble(double value, char* buffer)
+    {
+#if defined(__cpp_lib_to_chars)
+        auto result = to_chars(buffer, buffer + 32, value);
+        return (uint)(result.ptr - buffer);
+#else
+        for (auto precision = 15; precision <= 17; precision++)
+        {
+            auto length = snprintf(buffer, 32, "%.*g", precision, value);
+            if (precision == 17 || strtod(buffer, nullptr) == value)
+                return (uint)length;
+        }
+        return 0u;
+#endif
+    }
+
+    template<typename TSink>
+    class JsonWriter
+    {
+    private:
+
+        TSink& _sink;
+        const JsonWriteOptions _options;
+        uint _depth;
+
+        static inline bool NeedsEscape(uint8 c)
+        {
+            return c < 0x20 || c == '"' || c == '\\';
+        }
+
+        void WriteEscaped(uint8 c)
+        {
+            static const char hex[] = "0123456789abcdef";
+            char escape[6] = { '\\', 0, 0, 0, 0, 0 };
+            switch (c)
+            {
+            case '"': escape[1] = '"'; break;
+            case '\\': escape[1] = '\\'; break;
+            case '\b': escape[1] = 'b'; break;
+            case '\f': escape[1] = 'f'; break;
+            case '\n': escape[1] = 'n'; break;
+            case '\r': escape[1] = 'r'; break;
+            case '\t': escape[1] = 't'; break;
+            default:
+                escape[1] = 'u';
+                escape[2] = '0';
+                escape[3] = '0';
+                escape[4] = hex[c >> 4];
+                escape[5] = hex[c & 0xF];
+                _sink.Write(escape, 6u);
+                return;
+            }
+            _sink.Write(escape, 2u);
+        }
+
+        void WriteString(const string& value)
+        {
+            auto data = (const uint8*)value.data();
+            auto length = (uint)value.length();
+            auto start = 0u;
+            auto i = 0u;
+            _sink.Put('"');
+#if defined(TEXTSURVEY_SSE2)
+            auto quote = _mm_set1_epi8('"');
+            auto backslash = _mm_set1_epi8('\\');
+            auto control = _mm_set1_epi8(0x1F);
+            while (i + 16u <= length)
+            {
+                auto block = _mm_loadu_si128((const __m128i*)(data + i));
+                auto special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)),
+                    _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+                auto mask = (uint)_mm_movemask_epi8(special);
+                if (mask == 0u)
+                {
+                    i += 16u;
+                    continue;
+                }
+                i += TextSurvey::Simd::TrailingZeros(mask);
+                _sink.Write((const char*)data + start, i - start);
+                WriteEscaped(data[i]);
+                start = ++i;
+            }
+#endif
+            for (; i < length; i++)
+            {
+                if (!NeedsEscape(data[i]))
+                    continue;
+                _sink.Write((const char*)data + start, i - start);
+                WriteEscaped(data[i]);
+                start = i + 1u;
+            }
+            _sink.Write((const char*)data + start, length - start);
+            _sink.Put('"');
+        }
+
+        void WriteNumber(double value)
+        {
+            if (!isfinite(value))
+            {
+                _sink.Write("null", 4u);
+                return;
+            }
+            auto buffer = _sink.Reserve(32u);
+            _sink.Commit(FormatDouble(value, buffer));
+        }
+
+        void WriteNewLine()
+        {
+            static const char spaces[] = "                                ";
+            if (!_options.Pretty)
+                return;
+            _sink.Put('\n');
+            auto count = _depth * _options.Indent;
+            while (count > 0u)
+            {
+                auto n = min(count, (uint)(sizeof(spaces) - 1u));
+                _sink.Write(spaces, n);
+                count -= n;
+            }
+        }
+
+        void WriteObject(const JsonObject& value)
+        {
+            _sink.Put('{');
+            if (value.GetCount() == 0u)
+            {
+                _sink.Put('}');
+                return;
+            }
+            _depth++;
+            auto first = true;
+            for (auto& member : value.GetMembers())
+            {
+                if (!first)
+                    _sink.Put(',');
+                first = false;
+                WriteNewLine();
+                WriteString(*member.Key.Text);
+                if (_options.Pretty)
+                    _sink.Write(": ", 2u);
+                else
+                    _sink.Put(':');
+                WriteValue(*member.Value);
+            }
+            _depth--;
+            WriteNewLine();
+            _sink.Put('}');
+        }
+
+        void WriteArray(const JsonArray& value)
+        {
+            _sink.Put('[');
+            if (value.Elements.empty())
+            {
+                _sink.Put(']');
+                return;
+            }
+            _depth++;
+            auto first = true;
+            for (auto& element : value.Elements)
+            {
+                if (!first)
+                    _sink.Put(',');
+                first = false;
+                WriteNewLine();
+                WriteValue(*element);
+            }
+            _depth--;
+            WriteNewLine();
+            _sink.Put(']');
+        }
+
+    public:
+
+        JsonWriter(TSink& sink, const JsonWriteOptions& options = JsonWriteOptions()) :
+            _sink(sink), _options(options), _depth(0u)
+        {
+
+        }
+
+        void WriteValue(const JsonValue& value)
+        {
+            switch (value.GetType())
+            {
+            case JsonValueType::Null:
+                _sink.Write("null", 4u);
+                break;
+            case JsonValueType::Boolean:
+                if (static_cast<const JsonBoolean&>(value).Value)
+                    _sink.Write("true", 4u);
+                else
+                    _sink.Write("false", 5u);
+                break;
+            case JsonValueType::Number:
+                WriteNumber(static_cast<const JsonNumber&>(value).Value);
+                break;
+            case JsonValueType::String:
+                WriteString(static_cast<const JsonString&>(value).Value);
+                break;
+            case JsonValueType::Object:
+                WriteObject(static_cast<const JsonObject&>(value));
+                break;
+            case JsonValueType::Array:
+                WriteArray(static_cast<const JsonArray&>(value));
+                break;
+            }
+        }
+    };
+
+    template<typename TSink>
+    void Write(const JsonValue& value, TSink& sink, const JsonWriteOptions& options = JsonWriteOptions())
+    {
+        JsonWriter<TSink> writer(sink, options);
+        writer.WriteValue(value);
+    }
+
+    inline auto ToString(const JsonValue& value, const JsonWriteOptions& options = JsonWriteOptions()) -> string
+    {
+        JsonBuffer buffer;
+        Write(value, buffer, options);
+        return buffer.ToString();
+    }
+}
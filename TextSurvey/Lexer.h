@@ -0,0 +1,330 @@
+#pragma once
+
+#include "Parsers.h"
+#include "Simd.h"
+#include <string>
+#include <cstring>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    // Token kinds, starts and lengths stored as parallel arrays.
+    struct TokenBuffer
+    {
+        vector<uchar> Kinds;
+        vector<uint> Starts;
+        vector<uint> Lengths;
+
+        inline uint Size() const
+        {
+            return (uint)Kinds.size();
+        }
+
+        inline void Push(uchar kind, uint start, uint length)
+        {
+            Kinds.push_back(kind);
+            Starts.push_back(start);
+            Lengths.push_back(length);
+        }
+
+        inline void Clear()
+        {
+            Kinds.clear();
+            Starts.clear();
+            Lengths.clear();
+        }
+    };
+
+    struct Token
+    {
+        uchar Kind;
+        uint Start;
+        uint Length;
+
+        Token() :
+            Kind(0u), Start(0u), Length(0u)
+        {
+
+        }
+
+        Token(uchar kind, uint start, uint length) :
+            Kind(kind), Start(start), Length(length)
+        {
+
+        }
+    };
+
+    // Table driven byte lexer. A token is the longest of the literals and
+    // the run rule selected by its first byte; runs equal to a keyword take
+    // the keyword's kind. Skipped runs (whitespace, usually) are not emitted.
+    class Lexer
+    {
+    private:
+
+        static const uint8 NoRule = 0xFF;
+
+        struct RunRule
+        {
+            uchar Kind;
+            CharSet Rest;
+            bool Skip;
+            uint8 Bytes[4];
+            uint ByteCount;
+        };
+
+        struct Literal
+        {
+            string Text;
+            uchar Kind;
+        };
+
+        vector<RunRule> _rules;
+        vector<Literal> _literals;
+        vector<Literal> _keywords;
+        uint8 _dispatch[256];
+        vector<uint> _literalFirst[256];
+        uint _errorOffset;
+
+        auto AddRule(uchar kind, const CharSet& first, const CharSet& rest, bool skip) -> void
+        {
+            assert(_rules.size() < NoRule);
+            RunRule rule;
+            rule.Kind = kind;
+            rule.Rest = rest;
+            rule.Skip = skip;
+            rule.ByteCount = 0u;
+            for (auto c = 0u; skip && c < 256u; c++)
+            {
+                if (!rest.Contains((uint8)c))
+                    continue;
+                if (rule.ByteCount == 4u)
+                {
+                    rule.ByteCount = 0u;
+                    break;
+                }
+                rule.Bytes[rule.ByteCount++] = (uint8)c;
+            }
+            _rules.push_back(rule);
+            for (auto c = 0u; c < 256u; c++)
+                if (_dispatch[c] == NoRule && first.Contains((uint8)c))
+                    _dispatch[c] = (uint8)(_rules.size() - 1u);
+        }
+
+        inline auto ScanRun(const RunRule& rule, const uint8* data, uint i, uint length) -> uint
+        {
+#if defined(TEXTSURVEY_SSE2)
+            if (rule.ByteCount > 0u)
+            {
+                for (; i + 16u <= length; i += 16u)
+                {
+                    auto block = _mm_loadu_si128((const __m128i*)(data + i));
+                    auto member = _mm_setzero_si128();
+                    for (auto b = 0u; b < rule.ByteCount; b++)
+                        member = _mm_or_si128(member, _mm_cmpeq_epi8(block, _mm_set1_epi8((char)rule.Bytes[b])));
+                    auto outside = ~(uint)_mm_movemask_epi8(member) & 0xFFFFu;
+                    if (outside != 0u)
+                        return i + Simd::TrailingZeros(outside);
+                }
+            }
+#endif
+            while (i < length && rule.Rest.Contains(data[i]))
+                i++;
+            return i;
+        }
+
+        auto FindKeyword(const uint8* data, uint start, uint length, uchar kind) -> uchar
+        {
+            for (auto& keyword : _keywords)
+                if (keyword.Text.length() == length && memcmp(keyword.Text.data(), data + start, length) == 0)
+                    return keyword.Kind;
+            return kind;
+        }
+
+    public:
+
+        Lexer() :
+            _errorOffset(0u)
+        {
+            for (auto c = 0u; c < 256u; c++)
+                _dispatch[c] = NoRule;
+        }
+
+        // A token that starts with a byte in first and continues with bytes in rest.
+        void AddToken(uchar kind, const CharSet& first, const CharSet& rest)
+        {
+            AddRule(kind, first, rest, false);
+        }
+
+        void AddSkip(const CharSet& chars)
+        {
+            AddRule(0u, chars, chars, true);
+        }
+
+        void AddLiteral(uchar kind, const string& text)
+        {
+            assert(!text.empty());
+            Literal literal = { text, kind };
+            _literals.push_back(literal);
+            _literalFirst[(uint8)text[0]].push_back((uint)_literals.size() - 1u);
+        }
+
+        void AddKeyword(uchar kind, const string& text)
+        {
+            Literal keyword = { text, kind };
+            _keywords.push_back(keyword);
+        }
+
+        // Appends the tokens of data to tokens. On a byte no rule accepts it
+        // stops and returns false; GetErrorOffset tells where.
+        bool Tokenize(const uint8* data, uint length, TokenBuffer& tokens)
+        {
+            auto i = 0u;
+            while (i < length)
+            {
+                auto c = data[i];
+                auto bestLength = 0u;
+                uchar bestKind = 0u;
+                for (auto index : _literalFirst[c])
+                {
+                    auto& literal = _literals[index];
+                    auto n = (uint)literal.Text.length();
+                    if (n > bestLength && n <= length - i && memcmp(literal.Text.data(), data + i, n) == 0)
+                    {
+                        bestLength = n;
+                        bestKind = literal.Kind;
+                    }
+                }
+                auto skip = false;
+                if (_dispatch[c] != NoRule)
+                {
+                    auto& rule = _rules[_dispatch[c]];
+                    auto n = ScanRun(rule, data, i + 1u, length) - i;
+                    if (n > bestLength)
+                    {
+                        bestLength = n;
+                        bestKind = rule.Skip ? 0u : FindKeyword(data, i, n, rule.Kind);
+                        skip = rule.Skip;
+                    }
+                }
+                if (bestLength == 0u)
+                {
+                    _errorOffset = i;
+                    return false;
+                }
+                if (!skip)
+                    tokens.Push(bestKind, i, bestLength);
+                i += bestLength;
+            }
+            return true;
+        }
+
+        inline uint GetErrorOffset() const
+        {
+            return _errorOffset;
+        }
+    };
+
+    // Presents a token buffer through the TextStream contract: each "char"
+    // is a token kind and offsets count tokens, so the combinators in
+    // Parsers.h run over tokens and backtracking never lexes again. GetData
+    // and GetLength still describe the source text; GetEnd is the token
+    // count.
+    class TokenStream final : public TextStream
+    {
+    private:
+
+        const TokenBuffer& _tokens;
+        const uint _sourceLength;
+
+    protected:
+
+        auto GetSourceOffset(uint offset) -> uint
+        {
+            if (offset < _tokens.Size())
+                return _tokens.Starts[offset];
+            return _sourceLength;
+        }
+
+    public:
+
+        TokenStream(const uint8* source, uint sourceLength, const TokenBuffer& tokens) :
+            TextStream(source, tokens.Size()), _tokens(tokens), _sourceLength(sourceLength)
+        {
+            _lines = LineIndex(source, sourceLength);
+        }
+
+        auto GetLength() -> uint
+        {
+            return _sourceLength;
+        }
+
+        using TextStream::Next;
+
+        auto Next(uchar* buffer, uint count) -> uint
+        {
+            auto result = _length - _offset;
+            if (result > count)
+                result = count;
+            else if (result < count)
+                Touch(_length + 1u);
+            if (result > 0u)
+                memcpy(buffer, &_tokens.Kinds[_offset], result * sizeof(uchar));
+            _offset += result;
+            _charOffset = _offset;
+            Touch(_offset);
+            return result;
+        }
+
+        auto Back(uint count) -> uint
+        {
+            if (count > _offset)
+                count = _offset;
+            _offset -= count;
+            _charOffset = _offset;
+            return count;
+        }
+
+        inline auto GetToken(uint index) const -> Token
+        {
+            return Token(_tokens.Kinds[index], _tokens.Starts[index], _tokens.Lengths[index]);
+        }
+
+        inline auto GetTokenText(uint index) const -> string
+        {
+            return string((const char*)_data + _tokens.Starts[index], _tokens.Lengths[index]);
+        }
+    };
+
+    // Matches one token of kind and returns it with its source span. Fails
+    // on any stream other than a TokenStream.
+    template<typename U>
+    auto MatchToken(uchar kind) -> ParserType(Token, U)
+    {
+        auto id = FailureTracker::TokenId(kind);
+        return [kind, id] (State<U> state) -> Result<Token>
+        {
+            auto tokens = dynamic_cast<TokenStream*>(&state.Stream);
+            assert(tokens != nullptr);
+            if (tokens == nullptr)
+            {
+                NoteFailure(state, id);
+                return Result<Token>();
+            }
+            auto& stream = *tokens;
+            uchar c;
+            if (stream.Next(&c) == 0u)
+            {
+                NoteFailure(state, id);
+                return Result<Token>();
+            }
+            if (c != kind)
+            {
+                stream.Back(1);
+                NoteFailure(state, id);
+                return Result<Token>();
+            }
+            return Result<Token>(stream.GetToken(stream.GetOffset() - 1u));
+        };
+    }
+}
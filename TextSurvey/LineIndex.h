@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Common.h"
+#include "Simd.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    // Line and Column are 1-based, Column counts characters.
+    struct Position
+    {
+        uint Line;
+        uint Column;
+
+        Position() :
+            Line(1u), Column(1u)
+        {
+
+        }
+
+        Position(const uint line, const uint column) :
+            Line(line), Column(column)
+        {
+
+        }
+    };
+
+    // Byte offsets of line starts, scanned lazily up to the largest offset
+    // requested so far.
+    class LineIndex
+    {
+    private:
+
+        const uint8* _data;
+        uint _length;
+        uint _scanned;
+        vector<uint> _lineStarts;
+
+        void Extend(uint offset)
+        {
+            if (offset > _length)
+                offset = _length;
+            if (_lineStarts.empty())
+                _lineStarts.push_back(0u);
+            if (offset <= _scanned)
+                return;
+            auto& lineStarts = _lineStarts;
+            Simd::FindEach(_data, _scanned, offset, (uint8)'\n', [&lineStarts] (uint i)
+            {
+                lineStarts.push_back(i + 1u);
+            });
+            _scanned = offset;
+        }
+
+    public:
+
+        LineIndex(const uint8* data, uint length) :
+            _data(data), _length(length), _scanned(0u)
+        {
+
+        }
+
+        // Returns the 0-based line containing offset.
+        auto GetLine(uint offset) -> uint
+        {
+            Extend(offset);
+            auto p = upper_bound(_lineStarts.begin(), _lineStarts.end(), offset);
+            return (uint)(p - _lineStarts.begin()) - 1u;
+        }
+
+        auto GetLineStart(uint line) -> uint
+        {
+            assert(line < _lineStarts.size());
+            return _lineStarts[line];
+        }
+
+        auto GetScannedLineCount() -> uint
+        {
+            Extend(0u);
+            return (uint)_lineStarts.size();
+        }
+    };
+}
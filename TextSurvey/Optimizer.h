@@ -0,0 +1,618 @@
+#pragma once
+
+#include "Parsers.h"
+#include <string>
+#include <sstream>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    enum struct ParserKind
+    {
+        Opaque,
+        Char,
+        Literal,
+        Satisfy,
+        Sequence,
+        Many,
+        Choice,
+        Between,
+        TakeWhile,
+        KeywordSet
+    };
+
+    // What a Rule does, for inspection and rewriting.
+    struct ParserInfo
+    {
+        ParserKind Kind;
+        uchar Char;
+        vector<string> Literals;
+        function<bool(uchar)> Predicate;
+        uint Min;
+        uint Max;
+        vector<shared_ptr<const ParserInfo>> Children;
+        shared_ptr<const void> Parts;
+
+        ParserInfo(ParserKind kind) :
+            Kind(kind), Char(0u), Min(0u), Max(0u)
+        {
+
+        }
+    };
+
+    struct OptimizeReport
+    {
+        vector<string> Rewrites;
+    };
+
+    // A parser that carries a description of itself. Rules convert to the
+    // plain parser type, and the combinators below build described rules
+    // from described children, so a grammar can be written once and handed
+    // to Optimize.
+    template<typename R, typename U>
+    class Rule
+    {
+    public:
+
+        function<Result<R>(State<U>)> Run;
+        shared_ptr<const ParserInfo> Info;
+        function<Rule(OptimizeReport&)> Rewrite;
+
+        Rule(function<Result<R>(State<U>)> run) :
+            Run(run), Info(make_shared<ParserInfo>(ParserKind::Opaque))
+        {
+
+        }
+
+        Rule(
+            function<Result<R>(State<U>)> run,
+            shared_ptr<const ParserInfo> info,
+            function<Rule(OptimizeReport&)> rewrite = nullptr
+            ) :
+            Run(run), Info(info), Rewrite(rewrite)
+        {
+
+        }
+
+        inline auto operator()(State<U> state) const -> Result<R>
+        {
+            return Run(state);
+        }
+
+        operator function<Result<R>(State<U>)>() const
+        {
+            return Run;
+        }
+    };
+
+    // Rewrites rule bottom up into fused, specialized parsers with the same
+    // results and the same input consumption:
+    //   Sequence of Chars              -> one literal compare
+    //   Many(Satisfy) / Many(Char)     -> TakeWhile over 16 char blocks
+    //   Choice of literals             -> KeywordSet dispatched on first char
+    //   Between nested in Between      -> one Between with a single snapshot
+    template<typename R, typename U>
+    auto Optimize(const Rule<R, U>& rule, OptimizeReport& report) -> Rule<R, U>
+    {
+        if (!rule.Rewrite)
+            return rule;
+        return rule.Rewrite(report);
+    }
+
+    template<typename R, typename U>
+    auto Optimize(const Rule<R, U>& rule) -> Rule<R, U>
+    {
+        OptimizeReport report;
+        return Optimize(rule, report);
+    }
+
+    inline auto Describe(const ParserInfo& info) -> string
+    {
+        static const char* names[] =
+        {
+            "Opaque", "Char", "Literal", "Satisfy", "Sequence", "Many",
+            "Choice", "Between", "TakeWhile", "KeywordSet"
+        };
+        ostringstream out;
+        out << names[(int)info.Kind];
+        if (info.Kind == ParserKind::Char)
+            out << "(" << info.Char << ")";
+        for (auto i = 0u; i < info.Literals.size(); i++)
+            out << (i == 0u ? "(\"" : " \"") << info.Literals[i] << (i + 1u == info.Literals.size() ? "\")" : "\"");
+        for (auto i = 0u; i < info.Children.size(); i++)
+            out << (i == 0u ? "(" : ", ") << Describe(*info.Children[i]) << (i + 1u == info.Children.size() ? ")" : "");
+        return out.str();
+    }
+
+    // Fused Parsers
+
+    // Matches chars as one block read; leaves the stream untouched on failure
+    // and reports the expected item id at its start.
+    template<typename U>
+    auto MatchChars(const vector<uchar>& chars, const ExpectedItem& item) -> function<bool(State<U>)>
+    {
+        return [chars, item] (State<U> state) -> bool
+        {
+            const uint blockSize = 16u;
+            auto& stream = state.Stream;
+            auto extent = stream.GetExtent();
+            uchar buffer[blockSize];
+            auto length = (uint)chars.size();
+            auto read = 0u;
+            while (read < length)
+            {
+                auto count = min(blockSize, length - read);
+                auto n = stream.Next(buffer, count);
+                auto i = 0u;
+                while (i < n && buffer[i] == chars[read + i])
+                    i++;
+                read += i;
+                if (i < n || n < count)
+                {
+                    // Report the same look-ahead the chain of Match calls
+                    // would have: one char past the last match.
+                    stream.Back(n - i);
+                    stream.SetExtent(max(extent, stream.GetOffset()));
+                    uchar c;
+                    stream.Back(stream.Next(&c, 1u));
+                    stream.Back(read);
+                    NoteFailure(state, item);
+                    return false;
+                }
+            }
+            return true;
+        };
+    }
+
+    // Reports the expected item id where the run stops, as Many would.
+    template<typename U, typename TVector = vector<uchar>>
+    auto TakeWhile(
+        function<bool(uchar)> predicate,
+        uint minCount,
+        uint maxCount,
+        uint id = FailureTracker::Unspecified
+        ) -> ParserType(TVector, U)
+    {
+        typedef Result<TVector> Result;
+        return [predicate, minCount, maxCount, id] (State<U> state) -> Result
+        {
+            const uint blockSize = 16u;
+            auto& stream = state.Stream;
+            auto extent = stream.GetExtent();
+            TVector results(ResultAllocator<typename TVector::allocator_type>::Make(state.Memory));
+            uchar buffer[blockSize];
+            auto stopped = false;
+            while (!AtMax(Range(minCount, maxCount), (uint)results.size()))
+            {
+                auto count = blockSize;
+                if (maxCount != 0u)
+                    count = min(count, maxCount - (uint)results.size());
+                auto n = stream.Next(buffer, count);
+                auto i = 0u;
+                while (i < n && predicate(buffer[i]))
+                    i++;
+                results.insert(results.end(), buffer, buffer + i);
+                if (i < n || n < count)
+                {
+                    stream.Back(n - i);
+                    NoteFailure(state, id);
+                    stopped = true;
+                    break;
+                }
+            }
+            // Report the same look-ahead Many would have: one char past the run.
+            stream.SetExtent(max(extent, stream.GetOffset()));
+            if (stopped)
+            {
+                uchar c;
+                stream.Back(stream.Next(&c));
+            }
+            if (!InRange(Range(minCount, maxCount), (uint)results.size()))
+            {
+                stream.Back((uint)results.size());
+                return Result();
+            }
+            return Result(move(results));
+        };
+    }
+
+    // Ordered choice over literals: the first literal in order that matches wins.
+    template<typename U>
+    auto MatchKeywords(const vector<string>& keywords) -> ParserType(string, U)
+    {
+        auto index = make_shared<vector<vector<uint>>>(256u);
+        auto reach = make_shared<vector<uint>>();
+        auto items = make_shared<vector<ExpectedItem>>();
+        items->reserve(keywords.size());
+        auto maxLength = 0u;
+        for (auto i = 0u; i < keywords.size(); i++)
+        {
+            assert(!keywords[i].empty());
+            items->push_back(ExpectedItem(keywords[i], true));
+            maxLength = max(maxLength, (uint)keywords[i].length());
+            reach->push_back(maxLength);
+            if (!keywords[i].empty())
+                (*index)[(uint8)keywords[i][0]].push_back(i);
+        }
+        return [index, reach, items, maxLength] (State<U> state) -> Result<string>
+        {
+            auto& stream = state.Stream;
+            auto extent = stream.GetExtent();
+            const uint stackSize = 64u;
+            uchar stackBuffer[stackSize];
+            vector<uchar> heapBuffer;
+            auto buffer = stackBuffer;
+            if (maxLength > stackSize)
+            {
+                heapBuffer.resize(maxLength);
+                buffer = heapBuffer.data();
+            }
+            auto n = stream.Next(buffer, maxLength);
+            auto winner = -1;
+            if (n > 0u && buffer[0] < 256u)
+            {
+                for (auto k : (*index)[buffer[0]])
+                {
+                    auto& keyword = (*items)[k].GetText();
+                    auto length = (uint)keyword.length();
+                    auto i = 0u;
+                    while (i < length && i < n && buffer[i] == (uint8)keyword[i])
+                        i++;
+                    if (i == length)
+                    {
+                        winner = (int)k;
+                        break;
+                    }
+                }
+            }
+            // Re-read only as far as the equivalent chain of Match calls would.
+            stream.Back(n);
+            stream.SetExtent(extent);
+            // Every keyword tried before the winner failed here.
+            auto tried = winner < 0 ? (uint)items->size() : (uint)winner;
+            for (auto k = 0u; k < tried; k++)
+                NoteFailure(state, (*items)[k]);
+            auto reached = winner < 0 ? maxLength : (*reach)[winner];
+            auto m = stream.Next(buffer, reached);
+            if (winner < 0)
+            {
+                stream.Back(m);
+                return Result<string>();
+            }
+            auto& keyword = (*items)[winner].GetText();
+            stream.Back(m - (uint)keyword.length());
+            return Result<string>(keyword);
+        };
+    }
+
+    template<typename R, typename U>
+    struct BetweenParts
+    {
+        vector<function<bool(State<U>)>> Opens;
+        function<Result<R>(State<U>)> Middle;
+        vector<function<bool(State<U>)>> Closes;
+    };
+
+    template<typename R, typename U>
+    auto AsCheck(function<Result<R>(State<U>)> parser) -> function<bool(State<U>)>
+    {
+        return [parser] (State<U> state) -> bool
+        {
+            return parser(state).Code == ResultCode::Success;
+        };
+    }
+
+    template<typename R, typename U>
+    auto RunBetween(shared_ptr<const BetweenParts<R, U>> parts) -> ParserType(R, U)
+    {
+        return [parts] (State<U> state) -> Result<R>
+        {
+            auto snapshot = state.Stream.GetSnapshot();
+            for (auto& open : parts->Opens)
+            {
+                if (!open(state))
+                {
+                    snapshot.Restore();
+                    return Result<R>();
+                }
+            }
+            auto result = parts->Middle(state);
+            if (result.Code == ResultCode::Failure)
+            {
+                snapshot.Restore();
+                return result;
+            }
+            for (auto& close : parts->Closes)
+            {
+                if (!close(state))
+                {
+                    snapshot.Restore();
+                    return Result<R>();
+                }
+            }
+            return result;
+        };
+    }
+
+    // Described Rules
+
+    template<typename U>
+    auto MatchRule(uchar value) -> Rule<uchar, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Char);
+        info->Char = value;
+        return Rule<uchar, U>(Match<U>(value), info);
+    }
+
+    template<typename U>
+    auto MatchRule(const string& value) -> Rule<string, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Literal);
+        info->Literals.push_back(value);
+        return Rule<string, U>(Match<U>(value), info);
+    }
+
+    template<typename U>
+    auto SatisfyRule(function<bool(uchar)> predicate) -> Rule<uchar, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Satisfy);
+        info->Predicate = predicate;
+        return Rule<uchar, U>(Satisfy<U>(predicate), info);
+    }
+
+    template<typename R1, typename R2, typename U>
+    auto Sequence(const Rule<R1, U>& rule1, const Rule<R2, U>& rule2) -> Rule<tuple<R1, R2>, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Sequence);
+        info->Children.push_back(rule1.Info);
+        info->Children.push_back(rule2.Info);
+        return Rule<tuple<R1, R2>, U>(Sequence(rule1.Run, rule2.Run), info, [rule1, rule2] (OptimizeReport& report)
+        {
+            return FuseSequence(Optimize(rule1, report), Optimize(rule2, report), report);
+        });
+    }
+
+    template<typename R1, typename R2, typename R3, typename U>
+    auto Sequence(
+        const Rule<R1, U>& rule1,
+        const Rule<R2, U>& rule2,
+        const Rule<R3, U>& rule3
+        ) -> Rule<tuple<R1, R2, R3>, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Sequence);
+        info->Children.push_back(rule1.Info);
+        info->Children.push_back(rule2.Info);
+        info->Children.push_back(rule3.Info);
+        return Rule<tuple<R1, R2, R3>, U>(Sequence(rule1.Run, rule2.Run, rule3.Run), info, [rule1, rule2, rule3] (OptimizeReport& report)
+        {
+            return FuseSequence(Optimize(rule1, report), Optimize(rule2, report), Optimize(rule3, report), report);
+        });
+    }
+
+    template<typename TVector, typename R, typename U>
+    auto FuseMany(const Rule<R, U>& rule, uint minCount, uint maxCount, OptimizeReport& report) -> Rule<TVector, U>;
+
+    template<typename TVector, typename U>
+    auto FuseMany(const Rule<uchar, U>& rule, uint minCount, uint maxCount, OptimizeReport& report) -> Rule<TVector, U>;
+
+    template<typename TVector, typename R, typename U>
+    auto ManyInto(const Rule<R, U>& rule, const Range& range) -> Rule<TVector, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Many);
+        info->Min = range.Min;
+        info->Max = range.Max;
+        info->Children.push_back(rule.Info);
+        auto minCount = range.Min;
+        auto maxCount = range.Max;
+        return Rule<TVector, U>(ManyInto<TVector>(rule.Run, range), info, [rule, minCount, maxCount] (OptimizeReport& report)
+        {
+            return FuseMany<TVector>(Optimize(rule, report), minCount, maxCount, report);
+        });
+    }
+
+    template<typename R, typename U>
+    inline auto Many(const Rule<R, U>& rule, const Range& range = ZeroOrMore) -> Rule<vector<R>, U>
+    {
+        return ManyInto<vector<R>>(rule, range);
+    }
+
+    template<typename R, typename U>
+    inline auto ManyInArena(const Rule<R, U>& rule, const Range& range = ZeroOrMore) -> Rule<ArenaVector<R>, U>
+    {
+        return ManyInto<ArenaVector<R>>(rule, range);
+    }
+
+    template<typename R, typename U>
+    auto Choice(const Rule<R, U>& rule1, const Rule<R, U>& rule2) -> Rule<R, U>
+    {
+        auto info = make_shared<ParserInfo>(ParserKind::Choice);
+        info->Children.push_back(rule1.Info);
+        info->Children.push_back(rule2.Info);
+        return Rule<R, U>(Choice(rule1.Run, rule2.Run), info, [rule1, rule2] (OptimizeReport& report)
+        {
+            return FuseChoice(Optimize(rule1, report), Optimize(rule2, report), report);
+        });
+    }
+
+    template<typename R1, typename R2, typename R3, typename U>
+    auto Between(
+        const Rule<R1, U>& rule1,
+        const Rule<R2, U>& rule2,
+        const Rule<R3, U>& rule3
+        ) -> Rule<R2, U>
+    {
+        auto parts = make_shared<BetweenParts<R2, U>>();
+        parts->Opens.push_back(AsCheck(rule1.Run));
+        parts->Middle = rule2.Run;
+        parts->Closes.push_back(AsCheck(rule3.Run));
+        auto info = make_shared<ParserInfo>(ParserKind::Between);
+        info->Children.push_back(rule1.Info);
+        info->Children.push_back(rule2.Info);
+        info->Children.push_back(rule3.Info);
+        info->Parts = parts;
+        return Rule<R2, U>(Between(rule1.Run, rule2.Run, rule3.Run), info, [rule1, rule2, rule3] (OptimizeReport& report)
+        {
+            return FuseBetween(Optimize(rule1, report), Optimize(rule2, report), Optimize(rule3, report), report);
+        });
+    }
+
+    // Rewrites
+
+    template<typename R1, typename R2, typename U>
+    auto FuseSequence(const Rule<R1, U>& rule1, const Rule<R2, U>& rule2, OptimizeReport&) -> Rule<tuple<R1, R2>, U>
+    {
+        return Sequence(rule1, rule2);
+    }
+
+    template<typename U>
+    auto FuseSequence(const Rule<uchar, U>& rule1, const Rule<uchar, U>& rule2, OptimizeReport& report) -> Rule<tuple<uchar, uchar>, U>
+    {
+        if (rule1.Info->Kind != ParserKind::Char || rule2.Info->Kind != ParserKind::Char)
+            return Sequence(rule1, rule2);
+        auto c1 = rule1.Info->Char;
+        auto c2 = rule2.Info->Char;
+        vector<uchar> chars;
+        chars.push_back(c1);
+        chars.push_back(c2);
+        auto match = MatchChars<U>(chars, ExpectedItem(string(chars.begin(), chars.end()), true));
+        auto info = make_shared<ParserInfo>(ParserKind::Literal);
+        info->Literals.push_back(string(chars.begin(), chars.end()));
+        report.Rewrites.push_back("Sequence(Char, Char) -> Literal");
+        return Rule<tuple<uchar, uchar>, U>([match, c1, c2] (State<U> state) -> Result<tuple<uchar, uchar>>
+        {
+            if (!match(state))
+                return Result<tuple<uchar, uchar>>();
+            return Result<tuple<uchar, uchar>>(make_tuple(c1, c2));
+        }, info);
+    }
+
+    template<typename R1, typename R2, typename R3, typename U>
+    auto FuseSequence(
+        const Rule<R1, U>& rule1,
+        const Rule<R2, U>& rule2,
+        const Rule<R3, U>& rule3,
+        OptimizeReport&
+        ) -> Rule<tuple<R1, R2, R3>, U>
+    {
+        return Sequence(rule1, rule2, rule3);
+    }
+
+    template<typename U>
+    auto FuseSequence(
+        const Rule<uchar, U>& rule1,
+        const Rule<uchar, U>& rule2,
+        const Rule<uchar, U>& rule3,
+        OptimizeReport& report
+        ) -> Rule<tuple<uchar, uchar, uchar>, U>
+    {
+        if (rule1.Info->Kind != ParserKind::Char || rule2.Info->Kind != ParserKind::Char || rule3.Info->Kind != ParserKind::Char)
+            return Sequence(rule1, rule2, rule3);
+        auto value = make_tuple(rule1.Info->Char, rule2.Info->Char, rule3.Info->Char);
+        vector<uchar> chars;
+        chars.push_back(get<0>(value));
+        chars.push_back(get<1>(value));
+        chars.push_back(get<2>(value));
+        auto match = MatchChars<U>(chars, ExpectedItem(string(chars.begin(), chars.end()), true));
+        auto info = make_shared<ParserInfo>(ParserKind::Literal);
+        info->Literals.push_back(string(chars.begin(), chars.end()));
+        report.Rewrites.push_back("Sequence(Char, Char, Char) -> Literal");
+        return Rule<tuple<uchar, uchar, uchar>, U>([match, value] (State<U> state) -> Result<tuple<uchar, uchar, uchar>>
+        {
+            if (!match(state))
+                return Result<tuple<uchar, uchar, uchar>>();
+            return Result<tuple<uchar, uchar, uchar>>(value);
+        }, info);
+    }
+
+    template<typename TVector, typename R, typename U>
+    auto FuseMany(const Rule<R, U>& rule, uint minCount, uint maxCount, OptimizeReport&) -> Rule<TVector, U>
+    {
+        return ManyInto<TVector>(rule, Range(minCount, maxCount));
+    }
+
+    template<typename TVector, typename U>
+    auto FuseMany(const Rule<uchar, U>& rule, uint minCount, uint maxCount, OptimizeReport& report) -> Rule<TVector, U>
+    {
+        function<bool(uchar)> predicate;
+        auto id = FailureTracker::Unspecified;
+        if (rule.Info->Kind == ParserKind::Satisfy)
+        {
+            predicate = rule.Info->Predicate;
+        }
+        else if (rule.Info->Kind == ParserKind::Char)
+        {
+            auto c = rule.Info->Char;
+            predicate = [c] (uchar value) { return value == c; };
+            id = FailureTracker::CharId(c);
+        }
+        else
+        {
+            return ManyInto<TVector>(rule, Range(minCount, maxCount));
+        }
+        auto info = make_shared<ParserInfo>(ParserKind::TakeWhile);
+        info->Predicate = predicate;
+        info->Min = minCount;
+        info->Max = maxCount;
+        report.Rewrites.push_back(rule.Info->Kind == ParserKind::Satisfy ? "Many(Satisfy) -> TakeWhile" : "Many(Char) -> TakeWhile");
+        return Rule<TVector, U>(TakeWhile<U, TVector>(predicate, minCount, maxCount, id), info);
+    }
+
+    template<typename R, typename U>
+    auto FuseChoice(const Rule<R, U>& rule1, const Rule<R, U>& rule2, OptimizeReport&) -> Rule<R, U>
+    {
+        return Choice(rule1, rule2);
+    }
+
+    template<typename U>
+    auto FuseChoice(const Rule<string, U>& rule1, const Rule<string, U>& rule2, OptimizeReport& report) -> Rule<string, U>
+    {
+        auto isLiterals = [] (const ParserInfo& info)
+        {
+            return info.Kind == ParserKind::Literal || info.Kind == ParserKind::KeywordSet;
+        };
+        // Match("") always succeeds; MatchKeywords dispatches on a first char.
+        auto hasEmpty = [] (const ParserInfo& info)
+        {
+            for (auto& literal : info.Literals)
+            {
+                if (literal.empty())
+                    return true;
+            }
+            return false;
+        };
+        if (!isLiterals(*rule1.Info) || !isLiterals(*rule2.Info) || hasEmpty(*rule1.Info) || hasEmpty(*rule2.Info))
+            return Choice(rule1, rule2);
+        auto info = make_shared<ParserInfo>(ParserKind::KeywordSet);
+        info->Literals = rule1.Info->Literals;
+        info->Literals.insert(info->Literals.end(), rule2.Info->Literals.begin(), rule2.Info->Literals.end());
+        report.Rewrites.push_back("Choice(Literal, Literal) -> KeywordSet");
+        return Rule<string, U>(MatchKeywords<U>(info->Literals), info);
+    }
+
+    template<typename R1, typename R2, typename R3, typename U>
+    auto FuseBetween(
+        const Rule<R1, U>& rule1,
+        const Rule<R2, U>& rule2,
+        const Rule<R3, U>& rule3,
+        OptimizeReport& report
+        ) -> Rule<R2, U>
+    {
+        if (rule2.Info->Kind != ParserKind::Between)
+            return Between(rule1, rule2, rule3);
+        auto inner = static_pointer_cast<const BetweenParts<R2, U>>(rule2.Info->Parts);
+        auto parts = make_shared<BetweenParts<R2, U>>();
+        parts->Opens.push_back(AsCheck(rule1.Run));
+        parts->Opens.insert(parts->Opens.end(), inner->Opens.begin(), inner->Opens.end());
+        parts->Middle = inner->Middle;
+        parts->Closes = inner->Closes;
+        parts->Closes.push_back(AsCheck(rule3.Run));
+        auto info = make_shared<ParserInfo>(ParserKind::Between);
+        info->Children.push_back(rule1.Info);
+        info->Children.insert(info->Children.end(), rule2.Info->Children.begin(), rule2.Info->Children.end());
+        info->Children.push_back(rule3.Info);
+        info->Parts = parts;
+        report.Rewrites.push_back("Between(Between) -> Between");
+        return Rule<R2, U>(RunBetween<R2, U>(parts), info);
+    }
+}
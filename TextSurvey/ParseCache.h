@@ -0,0 +1,208 @@
+#pragma once
+
+#include "Batch.h"
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    // A fast, non-cryptographic 64-bit hash of length bytes, eight at a time.
+    inline auto HashBytes(const uint8* data, uint length, uint64_t seed = 0u) -> uint64_t
+    {
+        const uint64_t k1 = 0x9E3779B97F4A7C15ull;
+        const uint64_t k2 = 0xC2B2AE3D27D4EB4Full;
+        auto h = seed ^ ((uint64_t)length * k1);
+        auto i = 0u;
+        for (; i + 8u <= length; i += 8u)
+        {
+            uint64_t word;
+            memcpy(&word, data + i, 8u);
+            word *= k2;
+            word ^= word >> 31;
+            h = (h ^ word) * k1;
+            h = (h << 27) | (h >> 37);
+        }
+        uint64_t tail = 0u;
+        for (auto shift = 0u; i < length; i++, shift += 8u)
+            tail |= (uint64_t)data[i] << shift;
+        h = (h ^ (tail * k2)) * k1;
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    struct ParseCacheStats
+    {
+        uint64_t Hits;
+        uint64_t Misses;
+        uint64_t Evictions;
+        // Input bytes that hits did not have to parse.
+        uint64_t BytesSaved;
+        uint Entries;
+        size_t Bytes;
+
+        ParseCacheStats() :
+            Hits(0u), Misses(0u), Evictions(0u), BytesSaved(0u), Entries(0u), Bytes(0u)
+        {
+
+        }
+
+        inline auto GetHitRate() const -> double
+        {
+            return Hits + Misses == 0u ? 0.0 : (double)Hits / (double)(Hits + Misses);
+        }
+    };
+
+    // Keeps the results of successful parses keyed by grammar id and the
+    // hash and length of the input, so an input seen before costs a hash and
+    // a lookup. Results are shared and immutable, and must depend on nothing
+    // but the input bytes (no user state, no Arena). Entries are evicted in
+    // least recently used order once their measured size exceeds the
+    // budget. Inputs are not compared byte for byte, so two inputs of equal
+    // length whose 64-bit hashes collide share a result. Safe to use from
+    // several threads; parses themselves run outside the lock.
+    template<typename R, typename U, typename TStream = AsciiTextStream>
+    class ParseCache
+    {
+    private:
+
+        struct Key
+        {
+            uint Grammar;
+            uint Length;
+            uint64_t Hash;
+
+            inline bool operator==(const Key& other) const
+            {
+                return Hash == other.Hash && Length == other.Length && Grammar == other.Grammar;
+            }
+        };
+
+        struct KeyHash
+        {
+            inline size_t operator()(const Key& key) const
+            {
+                return (size_t)(key.Hash ^ ((uint64_t)key.Grammar << 32));
+            }
+        };
+
+        struct Entry
+        {
+            Key Id;
+            shared_ptr<const R> Value;
+            size_t Bytes;
+        };
+
+        typedef list<Entry> EntryList;
+
+        size_t _budget;
+        function<size_t(const R&, uint)> _measure;
+        // Most recently used first.
+        EntryList _entries;
+        unordered_map<Key, typename EntryList::iterator, KeyHash> _index;
+        ParseCacheStats _stats;
+        mutable mutex _lock;
+
+        void Evict(size_t needed)
+        {
+            while (!_entries.empty() && _stats.Bytes + needed > _budget)
+            {
+                auto& last = _entries.back();
+                _stats.Bytes -= last.Bytes;
+                _stats.Evictions++;
+                _index.erase(last.Id);
+                _entries.pop_back();
+            }
+            _stats.Entries = (uint)_entries.size();
+        }
+
+    public:
+
+        // measure gives the bytes an entry counts against budget. The default,
+        // the input length plus the size of R, budgets input bytes only; give
+        // a measure that walks the result when R owns more than that.
+        ParseCache(size_t budget, function<size_t(const R&, uint)> measure = nullptr) :
+            _budget(budget), _measure(measure)
+        {
+            if (!_measure)
+                _measure = [] (const R&, uint length) { return sizeof(R) + length; };
+        }
+
+        // Returns the result of grammar over data, or nullptr if it fails.
+        // Failures are not cached; when failures is given, the failed parse
+        // notes where it stopped there.
+        auto Parse(const Grammar<R, U>& grammar, const uint8* data, uint length, FailureTracker* failures = nullptr) -> shared_ptr<const R>
+        {
+            Key key = { grammar.GetId(), length, HashBytes(data, length) };
+            {
+                lock_guard<mutex> guard(_lock);
+                auto found = _index.find(key);
+                if (found != _index.end())
+                {
+                    _entries.splice(_entries.begin(), _entries, found->second);
+                    _stats.Hits++;
+                    _stats.BytesSaved += length;
+                    return found->second->Value;
+                }
+                _stats.Misses++;
+            }
+
+            TStream stream(data, length);
+            State<U> state(stream, nullptr, nullptr, nullptr, failures);
+            auto result = grammar(state);
+            if (result.Code == ResultCode::Failure)
+                return nullptr;
+            auto value = make_shared<const R>(move(result.Value));
+            auto bytes = _measure(*value, length);
+
+            lock_guard<mutex> guard(_lock);
+            auto found = _index.find(key);
+            if (found != _index.end())
+                return found->second->Value;
+            if (bytes > _budget)
+                return value;
+            Evict(bytes);
+            Entry entry = { key, value, bytes };
+            _entries.push_front(entry);
+            _index[key] = _entries.begin();
+            _stats.Bytes += bytes;
+            _stats.Entries = (uint)_entries.size();
+            return value;
+        }
+
+        inline auto Parse(const Grammar<R, U>& grammar, const TextInput& input, FailureTracker* failures = nullptr) -> shared_ptr<const R>
+        {
+            return Parse(grammar, input.Data, input.Length, failures);
+        }
+
+        auto GetStats() const -> ParseCacheStats
+        {
+            lock_guard<mutex> guard(_lock);
+            return _stats;
+        }
+
+        // Evicts entries as needed to fit a new budget.
+        void SetBudget(size_t budget)
+        {
+            lock_guard<mutex> guard(_lock);
+            _budget = budget;
+            Evict(0u);
+        }
+
+        void Clear()
+        {
+            lock_guard<mutex> guard(_lock);
+            _entries.clear();
+            _index.clear();
+            _stats.Bytes = 0u;
+            _stats.Entries = 0u;
+        }
+    };
+}
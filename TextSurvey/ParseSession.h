@@ -0,0 +1,326 @@
+#pragma once
+
+#include "Common.h"
+#include <string>
+#include <atomic>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    class FailureTracker;
+
+    // Replaces RemovedLength bytes at Offset with InsertedText. Offsets of
+    // later edits in a list refer to the text after earlier edits applied.
+    struct Edit
+    {
+        uint Offset;
+        uint RemovedLength;
+        string InsertedText;
+
+        Edit(uint offset, uint removedLength, const string& insertedText) :
+            Offset(offset), RemovedLength(removedLength), InsertedText(insertedText)
+        {
+
+        }
+    };
+
+    inline void ApplyEdits(string& text, const vector<Edit>& edits)
+    {
+        for (auto& edit : edits)
+            text.replace(edit.Offset, edit.RemovedLength, edit.InsertedText);
+    }
+
+    // Results of memoized rules keyed by (start offset, rule). Each entry
+    // remembers how far its parse looked ahead so an edit only invalidates
+    // results whose examined bytes it touches; the rest are shifted.
+    //
+    // Entries live in a treap ordered by start, whose nodes carry a pending
+    // shift for their subtrees and the largest extent below them. An edit
+    // shifts everything after it by tagging one subtree and only descends
+    // into subtrees that looked past its offset, so it costs time in the
+    // log of the session size plus the entries it invalidates.
+    class ParseSession
+    {
+    public:
+
+        struct Entry
+        {
+            uint Start;
+            uint End;
+            uint CharLength;
+            uint Extent;
+            bool Success;
+            shared_ptr<void> Value;
+            // Whether the rule ran with a FailureTracker, and what it noted
+            // there with offsets relative to Start (null if nothing).
+            bool Tracked;
+            shared_ptr<const FailureTracker> Failures;
+        };
+
+    private:
+
+        static const int None = -1;
+
+        struct Node
+        {
+            Entry Value;
+            uint Rule;
+            uint Priority;
+            int Left;
+            int Right;
+            // Added to every entry below this node, not yet to the children.
+            int Shift;
+            uint MaxExtent;
+        };
+
+        vector<Node> _nodes;
+        vector<int> _free;
+        int _root;
+        uint _count;
+        uint _seed;
+        uint _hits;
+        uint _misses;
+        bool _checkpoints;
+
+        static inline uint64_t Key(uint start, uint rule)
+        {
+            return ((uint64_t)start << 32) | rule;
+        }
+
+        inline uint64_t KeyOf(int node) const
+        {
+            return Key(_nodes[node].Value.Start, _nodes[node].Rule);
+        }
+
+        void Move(int node, int delta)
+        {
+            if (node == None)
+                return;
+            auto& n = _nodes[node];
+            n.Value.Start += delta;
+            n.Value.End += delta;
+            n.Value.Extent += delta;
+            n.MaxExtent += delta;
+            n.Shift += delta;
+        }
+
+        void Push(int node)
+        {
+            auto& n = _nodes[node];
+            if (n.Shift == 0)
+                return;
+            Move(n.Left, n.Shift);
+            Move(n.Right, n.Shift);
+            n.Shift = 0;
+        }
+
+        void Update(int node)
+        {
+            auto& n = _nodes[node];
+            n.MaxExtent = n.Value.Extent;
+            if (n.Left != None)
+                n.MaxExtent = max(n.MaxExtent, _nodes[n.Left].MaxExtent);
+            if (n.Right != None)
+                n.MaxExtent = max(n.MaxExtent, _nodes[n.Right].MaxExtent);
+        }
+
+        // Splits node into the entries with keys below key and the rest.
+        void Split(int node, uint64_t key, int& left, int& right)
+        {
+            if (node == None)
+            {
+                left = right = None;
+                return;
+            }
+            Push(node);
+            if (KeyOf(node) < key)
+            {
+                Split(_nodes[node].Right, key, _nodes[node].Right, right);
+                left = node;
+            }
+            else
+            {
+                Split(_nodes[node].Left, key, left, _nodes[node].Left);
+                right = node;
+            }
+            Update(node);
+        }
+
+        auto Merge(int left, int right) -> int
+        {
+            if (left == None)
+                return right;
+            if (right == None)
+                return left;
+            if (_nodes[left].Priority > _nodes[right].Priority)
+            {
+                Push(left);
+                _nodes[left].Right = Merge(_nodes[left].Right, right);
+                Update(left);
+                return left;
+            }
+            Push(right);
+            _nodes[right].Left = Merge(left, _nodes[right].Left);
+            Update(right);
+            return right;
+        }
+
+        void Release(int node)
+        {
+            _nodes[node].Value.Value.reset();
+            _nodes[node].Value.Failures.reset();
+            _free.push_back(node);
+            _count--;
+        }
+
+        // Drops the entries below node whose extent passes offset.
+        auto Invalidate(int node, uint offset) -> int
+        {
+            if (node == None || _nodes[node].MaxExtent <= offset)
+                return node;
+            Push(node);
+            auto left = Invalidate(_nodes[node].Left, offset);
+            auto right = Invalidate(_nodes[node].Right, offset);
+            if (_nodes[node].Value.Extent > offset)
+            {
+                Release(node);
+                return Merge(left, right);
+            }
+            _nodes[node].Left = left;
+            _nodes[node].Right = right;
+            Update(node);
+            return node;
+        }
+
+        auto NextPriority() -> uint
+        {
+            _seed ^= _seed << 13;
+            _seed ^= _seed >> 17;
+            _seed ^= _seed << 5;
+            return _seed;
+        }
+
+    public:
+
+        ParseSession() :
+            _root(None), _count(0u), _seed(2463534242u), _hits(0u), _misses(0u), _checkpoints(false)
+        {
+
+        }
+
+        static auto NewRuleId() -> uint
+        {
+            static atomic<uint> next(1u);
+            return next++;
+        }
+
+        auto Find(uint rule, uint start) -> const Entry*
+        {
+            auto key = Key(start, rule);
+            auto node = _root;
+            while (node != None)
+            {
+                Push(node);
+                auto nodeKey = KeyOf(node);
+                if (nodeKey == key)
+                {
+                    _hits++;
+                    return &_nodes[node].Value;
+                }
+                node = key < nodeKey ? _nodes[node].Left : _nodes[node].Right;
+            }
+            _misses++;
+            return nullptr;
+        }
+
+        void Store(uint rule, const Entry& entry)
+        {
+            auto key = Key(entry.Start, rule);
+            int left, middle, right;
+            Split(_root, key, left, right);
+            Split(right, key + 1u, middle, right);
+            if (middle == None)
+            {
+                if (_free.empty())
+                {
+                    _nodes.push_back(Node());
+                    middle = (int)_nodes.size() - 1;
+                }
+                else
+                {
+                    middle = _free.back();
+                    _free.pop_back();
+                }
+                _count++;
+            }
+            auto& n = _nodes[middle];
+            n.Value = entry;
+            n.Rule = rule;
+            n.Priority = NextPriority();
+            n.Left = n.Right = None;
+            n.Shift = 0;
+            n.MaxExtent = entry.Extent;
+            _root = Merge(Merge(left, middle), right);
+        }
+
+        void Apply(uint offset, uint removedLength, uint insertedLength)
+        {
+            auto removedEnd = offset + removedLength;
+            auto delta = (int)insertedLength - (int)removedLength;
+            int left, right;
+            Split(_root, Key(removedEnd, 0u), left, right);
+            Move(right, delta);
+            _root = Merge(Invalidate(left, offset), right);
+        }
+
+        inline void Apply(const Edit& edit)
+        {
+            Apply(edit.Offset, edit.RemovedLength, (uint)edit.InsertedText.length());
+        }
+
+        void Apply(const vector<Edit>& edits)
+        {
+            for (auto& edit : edits)
+                Apply(edit);
+        }
+
+        void Clear()
+        {
+            _nodes.clear();
+            _free.clear();
+            _root = None;
+            _count = 0u;
+            _hits = 0u;
+            _misses = 0u;
+        }
+
+        // Lets Many, Split and Until record the items they completed, so a
+        // later run at the same offset resumes after them. Worth it when the
+        // same text is parsed again with only data appended or edited late.
+        inline void SetCheckpoints(bool enabled)
+        {
+            _checkpoints = enabled;
+        }
+
+        inline bool KeepsCheckpoints() const
+        {
+            return _checkpoints;
+        }
+
+        inline uint GetEntryCount()
+        {
+            return _count;
+        }
+
+        inline uint GetHitCount()
+        {
+            return _hits;
+        }
+
+        inline uint GetMissCount()
+        {
+            return _misses;
+        }
+    };
+}
@@ -3,6 +3,9 @@
 #include "Common.h"
 #include "Support.h"
 #include "TextStream.h"
+#include "FailureTracker.h"
+#include "ParseSession.h"
+#include "Arena.h"
 
 #define ParserType(R, U) function<Result<R>(State<U>)>
 
@@ -33,7 +36,7 @@ namespace TextSurvey
         // Construct Success Result
         Result(R value) :
             Code(ResultCode::Success),
-            Value(value)
+            Value(move(value))
         {
 
         }
@@ -43,22 +46,53 @@ namespace TextSurvey
     struct State {
         TextStream& Stream;
         const U* UserState;
+        ParseSession* Session;
+        Arena* Memory;
+        FailureTracker* Failures;
         State(TextStream& stream) :
-            Stream(stream), UserState(nullptr)
+            Stream(stream), UserState(nullptr), Session(nullptr), Memory(nullptr), Failures(nullptr)
         {
 
         }
         State(TextStream& stream, const U* userState) :
-            Stream(stream), UserState(userState)
+            Stream(stream), UserState(userState), Session(nullptr), Memory(nullptr), Failures(nullptr)
+        {
+
+        }
+        State(TextStream& stream, const U* userState, ParseSession* session, Arena* memory = nullptr, FailureTracker* failures = nullptr) :
+            Stream(stream), UserState(userState), Session(session), Memory(memory), Failures(failures)
         {
 
         }
     };
 
+    // Tells the state's FailureTracker, if any, that a parser failed at the
+    // current offset expecting id.
+    template<typename U>
+    inline void NoteFailure(const State<U>& state, uint id)
+    {
+        if (state.Failures != nullptr)
+            state.Failures->Fail(state.Stream.GetOffset(), id);
+    }
+
+    template<typename U>
+    inline void NoteFailure(const State<U>& state, const ExpectedItem& item)
+    {
+        if (state.Failures != nullptr)
+            state.Failures->Fail(state.Stream.GetOffset(), item.GetId());
+    }
+
+    template<typename U>
+    inline void NoteFailure(const State<U>& state)
+    {
+        if (state.Failures != nullptr)
+            state.Failures->Fail(state.Stream.GetOffset());
+    }
+
     template<typename R, typename U> 
     auto Zero() -> ParserType(R, U)
     {
-        return [] (State<U> state) -> Result<R>
+        return [] (State<U>) -> Result<R>
         {
             return Result<R>();
         };
@@ -67,7 +101,7 @@ namespace TextSurvey
     template<typename R, typename U> 
     auto Return(R value) -> ParserType(R, U)
     {
-        return [value] (State<U> state) -> Result<R>
+        return [value] (State<U>) -> Result<R>
         {
             return Result<R>(value);
         };
@@ -81,7 +115,7 @@ namespace TextSurvey
         return [parser] (State<U> state) -> Result<Option<R>>
         {
             auto result = parser(state);
-            auto value = result.Code == ResultCode::Success ? Some(result.Vale) : None<R>();
+            auto value = result.Code == ResultCode::Success ? Some(result.Value) : None<R>();
             return Result<Option<R>>(value);
         };
     }
@@ -152,105 +186,270 @@ namespace TextSurvey
         };
     }
 
-    template<typename R, typename U> 
-    auto Many(
+    // Remembers the items a repetition completed at its start offset when
+    // State.Session keeps checkpoints, so the next run there resumes after
+    // them as long as no edit touched the bytes they examined. Only a
+    // repetition that ran into the end of the data saves one, since that is
+    // the one a parse resumed with more data repeats. Items are detached from
+    // the arena when saved; each save only adds the new ones. Runs with a
+    // FailureTracker skip checkpoints, since resuming would lose the failures
+    // the skipped items noted.
+    template<typename TVector>
+    class RepetitionCheckpoint
+    {
+    private:
+
+        ParseSession* _session;
+        TextStream& _stream;
+        uint _rule;
+        uint _start;
+        uint _charStart;
+        uint _outerExtent;
+        shared_ptr<TVector> _saved;
+        uint _count;
+        uint _end;
+        uint _charLength;
+        uint _extent;
+
+    public:
+
+        template<typename U>
+        RepetitionCheckpoint(const State<U>& state, uint rule) :
+            _session(state.Session != nullptr && state.Session->KeepsCheckpoints() && state.Failures == nullptr ? state.Session : nullptr),
+            _stream(state.Stream), _rule(rule), _start(0u), _charStart(0u), _outerExtent(0u), _count(0u), _end(0u), _charLength(0u), _extent(0u)
+        {
+            if (_session == nullptr)
+                return;
+            _start = _stream.GetOffset();
+            _charStart = _stream.GetCharOffset();
+            _outerExtent = _stream.GetExtent();
+            _stream.SetExtent(_start);
+        }
+
+        // Appends the saved items to results and moves past them.
+        void Resume(TVector& results)
+        {
+            if (_session == nullptr)
+                return;
+            auto entry = _session->Find(_rule, _start);
+            if (entry == nullptr)
+                return;
+            _saved = static_pointer_cast<TVector>(entry->Value);
+            results.insert(results.end(), _saved->begin(), _saved->end());
+            _stream.Seek(entry->End, _charStart + entry->CharLength);
+            _stream.SetExtent(entry->Extent);
+            Mark((uint)results.size());
+        }
+
+        // Records that the first count items of the results are complete.
+        inline void Mark(uint count)
+        {
+            if (_session == nullptr)
+                return;
+            _count = count;
+            _end = _stream.GetOffset();
+            _charLength = _stream.GetCharOffset() - _charStart;
+            _extent = _stream.GetExtent();
+        }
+
+        // Saves the marked items and gives the stream back its outer extent.
+        void Save(const TVector& results)
+        {
+            if (_session == nullptr)
+                return;
+            auto open = _stream.GetExtent() > _stream.GetEnd();
+            if (open && _count > 0u && (_saved == nullptr || _count > (uint)_saved->size()))
+            {
+                if (_saved == nullptr)
+                    _saved = make_shared<TVector>(ResultAllocator<typename TVector::allocator_type>::Make(nullptr));
+                for (auto i = (uint)_saved->size(); i < _count; i++)
+                    _saved->push_back(Detach(results[i]));
+                ParseSession::Entry entry;
+                entry.Start = _start;
+                entry.End = _end;
+                entry.CharLength = _charLength;
+                entry.Extent = _extent;
+                entry.Success = true;
+                entry.Value = _saved;
+                entry.Tracked = false;
+                _session->Store(_rule, entry);
+            }
+            _stream.SetExtent(max(_outerExtent, _stream.GetExtent()));
+        }
+    };
+
+    // Many, Split and Until return a vector on the heap; their InArena forms
+    // return an ArenaVector drawn from State.Memory, which must outlive it.
+    template<typename TVector, typename R, typename U> 
+    auto ManyInto(
         function<Result<R>(State<U>)> parser, 
-        const Range& range = ZeroOrMore
-        ) -> function<Result<vector<R>>(State<U>)>
+        const Range& range
+        ) -> function<Result<TVector>(State<U>)>
     {
-        typedef Result<vector<R>> Result;
-        return [parser, range] (State<U> state) -> Result
+        typedef Result<TVector> Result;
+        auto rule = ParseSession::NewRuleId();
+        return [parser, range, rule] (State<U> state) -> Result
         {
             auto snapshot = state.Stream.GetSnapshot();
-            vector<R> results;
-            auto result = parser(state);
-            while (result.Code == ResultCode::Success) 
+            TVector results(ResultAllocator<typename TVector::allocator_type>::Make(state.Memory));
+            RepetitionCheckpoint<TVector> checkpoint(state, rule);
+            checkpoint.Resume(results);
+            while (!AtMax(range, (uint)results.size())) 
             {
-                if (InRange(range, results.size()))
-                {
-                    snapshot.Restore();
-                    return Result();
-                }
+                auto result = parser(state);
+                if (result.Code == ResultCode::Failure)
+                    break;
                 results.push_back(result.Value);
-                result = parser(state);
+                checkpoint.Mark((uint)results.size());
             }
-            if (InRange(range, results.size()))
+            checkpoint.Save(results);
+            if (!InRange(range, (uint)results.size()))
             {
                 snapshot.Restore();
                 return Result();
             }
-            return Result(results);
+            return Result(move(results));
         };
     }
 
-    template<typename R1, typename R2, typename U> 
-    auto Split(
+    template<typename TVector, typename R1, typename R2, typename U> 
+    auto SplitInto(
         function<Result<R1>(State<U>)> parser, 
         function<Result<R2>(State<U>)> separatorParser, 
-        const Range& range = ZeroOrMore
-        ) -> function<Result<vector<R1>>(State<U>)> 
+        const Range& range
+        ) -> function<Result<TVector>(State<U>)> 
     {
-        typedef Result<vector<R1>> Result;
-        return [parser, splitter, range] (State<U> state) -> Result
+        typedef Result<TVector> Result;
+        auto rule = ParseSession::NewRuleId();
+        return [parser, separatorParser, range, rule] (State<U> state) -> Result
         {
             auto snapshot = state.Stream.GetSnapshot();
-            vector<R1> results;
-            auto result = parser(state);
-            while (result.Code == ResultCode::Success) 
+            TVector results(ResultAllocator<typename TVector::allocator_type>::Make(state.Memory));
+            RepetitionCheckpoint<TVector> checkpoint(state, rule);
+            checkpoint.Resume(results);
+            auto result = results.empty() ? parser(state) : TextSurvey::Result<R1>();
+            if (result.Code == ResultCode::Success)
             {
-                if (InRange(range, results.size()))
-                {
-                    snapshot.Restore();
-                    return Result();
-                }
                 results.push_back(result.Value);
+                checkpoint.Mark((uint)results.size());
+            }
+            while (!results.empty() && !AtMax(range, (uint)results.size())) 
+            {
+                auto separatorSnapshot = state.Stream.GetSnapshot();
                 auto separatorResult = separatorParser(state);
                 if (separatorResult.Code == ResultCode::Failure)
                     break;
                 result = parser(state);
+                if (result.Code == ResultCode::Failure)
+                {
+                    separatorSnapshot.Restore();
+                    break;
+                }
+                results.push_back(result.Value);
+                checkpoint.Mark((uint)results.size());
             }
-            if (InRange(range, results.size()))
+            checkpoint.Save(results);
+            if (!InRange(range, (uint)results.size()))
             {
                 snapshot.Restore();
                 return Result();
             }
-            return Result(results);
+            return Result(move(results));
         };
     }
 
-    template<typename R1, typename R2, typename U> 
-    auto Until(
+    template<typename TVector, typename R1, typename R2, typename U> 
+    auto UntilInto(
         function<Result<R1>(State<U>)> parser, 
         function<Result<R2>(State<U>)> endParser, 
-        const Range& range = ZeroOrMore
-        ) -> function<Result<vector<R1>>(State<U>)> 
+        const Range& range
+        ) -> function<Result<TVector>(State<U>)> 
     {
-        typedef Result<vector<R1>> Result;
-        return [parser, endParser, range] (State<U> state) -> Result
+        typedef Result<TVector> Result;
+        auto rule = ParseSession::NewRuleId();
+        return [parser, endParser, range, rule] (State<U> state) -> Result
         {
             auto snapshot = state.Stream.GetSnapshot();
-            vector<R1> results;
-            auto result = parser(state);
-            while (result.Code == ResultCode::Success) 
+            TVector results(ResultAllocator<typename TVector::allocator_type>::Make(state.Memory));
+            RepetitionCheckpoint<TVector> checkpoint(state, rule);
+            checkpoint.Resume(results);
+            while (!AtMax(range, (uint)results.size())) 
             {
-                if (InRange(range, results.size()))
-                {
-                    snapshot.Restore();
-                    return Result();
-                }
+                auto result = parser(state);
+                if (result.Code == ResultCode::Failure)
+                    break;
                 results.push_back(result.Value);
-                result = parser(state);
+                checkpoint.Mark((uint)results.size());
             }
+            checkpoint.Save(results);
             auto endResult = endParser(state);
-            if (endResult.Code == ResultCode::Failure || InRange(range, results.size()))
+            if (endResult.Code == ResultCode::Failure || !InRange(range, (uint)results.size()))
             {
                 snapshot.Restore();
                 return Result();
             }
-            return Result(results);
+            return Result(move(results));
         };
     }
 
+    template<typename R, typename U> 
+    inline auto Many(
+        function<Result<R>(State<U>)> parser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<vector<R>>(State<U>)>
+    {
+        return ManyInto<vector<R>>(parser, range);
+    }
+
+    template<typename R, typename U> 
+    inline auto ManyInArena(
+        function<Result<R>(State<U>)> parser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<ArenaVector<R>>(State<U>)>
+    {
+        return ManyInto<ArenaVector<R>>(parser, range);
+    }
+
+    template<typename R1, typename R2, typename U> 
+    inline auto Split(
+        function<Result<R1>(State<U>)> parser, 
+        function<Result<R2>(State<U>)> separatorParser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<vector<R1>>(State<U>)> 
+    {
+        return SplitInto<vector<R1>>(parser, separatorParser, range);
+    }
+
+    template<typename R1, typename R2, typename U> 
+    inline auto SplitInArena(
+        function<Result<R1>(State<U>)> parser, 
+        function<Result<R2>(State<U>)> separatorParser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<ArenaVector<R1>>(State<U>)> 
+    {
+        return SplitInto<ArenaVector<R1>>(parser, separatorParser, range);
+    }
+
+    template<typename R1, typename R2, typename U> 
+    inline auto Until(
+        function<Result<R1>(State<U>)> parser, 
+        function<Result<R2>(State<U>)> endParser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<vector<R1>>(State<U>)> 
+    {
+        return UntilInto<vector<R1>>(parser, endParser, range);
+    }
+
+    template<typename R1, typename R2, typename U> 
+    inline auto UntilInArena(
+        function<Result<R1>(State<U>)> parser, 
+        function<Result<R2>(State<U>)> endParser, 
+        const Range& range = ZeroOrMore
+        ) -> function<Result<ArenaVector<R1>>(State<U>)> 
+    {
+        return UntilInto<ArenaVector<R1>>(parser, endParser, range);
+    }
+
     template<typename R, typename U> 
     auto Choice(
         function<Result<R>(State<U>)> parser1, 
@@ -295,22 +494,136 @@ namespace TextSurvey
         };
     }
 
+    // Caches results in State.Session so a reparse after an edit reuses
+    // every result whose examined input the edit did not touch. Cached
+    // values are detached from State.Memory, which is reset between parses.
+    // The failures a rule noted are kept with its result and noted again on
+    // a hit, so a reparse reports the same errors.
+    template<typename R, typename U> 
+    auto Memo(
+        function<Result<R>(State<U>)> parser
+        ) -> ParserType(R, U)
+    {
+        auto rule = ParseSession::NewRuleId();
+        return [parser, rule] (State<U> state) -> Result<R>
+        {
+            if (state.Session == nullptr)
+                return parser(state);
+            auto& stream = state.Stream;
+            auto start = stream.GetOffset();
+            auto outerExtent = stream.GetExtent();
+            auto outerFailures = state.Failures;
+            auto entry = state.Session->Find(rule, start);
+            if (entry != nullptr && (entry->Tracked || outerFailures == nullptr))
+            {
+                stream.Seek(entry->End, stream.GetCharOffset() + entry->CharLength);
+                stream.SetExtent(max(outerExtent, entry->Extent));
+                if (outerFailures != nullptr && entry->Failures != nullptr)
+                    outerFailures->Merge(*entry->Failures, (int)start);
+                if (!entry->Success)
+                    return Result<R>();
+                return Result<R>(*static_pointer_cast<R>(entry->Value));
+            }
+            auto charStart = stream.GetCharOffset();
+            stream.SetExtent(start);
+            FailureTracker failures;
+            if (outerFailures != nullptr)
+                state.Failures = &failures;
+            auto result = parser(state);
+            ParseSession::Entry newEntry;
+            newEntry.Tracked = outerFailures != nullptr;
+            if (newEntry.Tracked)
+            {
+                outerFailures->Merge(failures);
+                if (failures.HasFailed())
+                {
+                    auto kept = make_shared<FailureTracker>();
+                    kept->Merge(failures, -(int)start);
+                    newEntry.Failures = kept;
+                }
+            }
+            newEntry.Start = start;
+            newEntry.End = stream.GetOffset();
+            newEntry.CharLength = stream.GetCharOffset() - charStart;
+            newEntry.Extent = stream.GetExtent();
+            newEntry.Success = result.Code == ResultCode::Success;
+            if (newEntry.Success)
+                newEntry.Value = make_shared<R>(Detach(result.Value));
+            state.Session->Store(rule, newEntry);
+            stream.SetExtent(max(outerExtent, newEntry.Extent));
+            return result;
+        };
+    }
+
+    // Labels parser for instrumentation: with TEXTSURVEY_INSTRUMENT each call
+    // adds its calls, allocations and bytes to the stream's Instrumentation;
+    // otherwise parser is returned as is.
+    template<typename R, typename U> 
+    auto Named(
+        const string& name,
+        function<Result<R>(State<U>)> parser
+        ) -> ParserType(R, U)
+    {
+#if defined(TEXTSURVEY_INSTRUMENT)
+        auto rule = Instrumentation::RegisterRule(name);
+        return [parser, rule] (State<U> state) -> Result<R>
+        {
+            auto probe = state.Stream.GetInstrumentation();
+            if (probe == nullptr)
+                return parser(state);
+            auto before = probe->Measure(state.Memory);
+            auto result = parser(state);
+            probe->OnRule(rule, before, state.Memory);
+            return result;
+        };
+#else
+        (void)name;
+        return parser;
+#endif
+    }
+
+    // Reports name as the item expected when parser fails without getting
+    // past its starting offset, in place of what its parts expected.
+    template<typename R, typename U> 
+    auto Expect(
+        const string& name,
+        function<Result<R>(State<U>)> parser
+        ) -> ParserType(R, U)
+    {
+        ExpectedItem item(name);
+        return [parser, item] (State<U> state) -> Result<R>
+        {
+            auto failures = state.Failures;
+            if (failures == nullptr)
+                return parser(state);
+            auto mark = failures->GetMark();
+            auto start = state.Stream.GetOffset();
+            auto result = parser(state);
+            if (result.Code == ResultCode::Failure)
+                failures->Relabel(mark, start, item.GetId());
+            return result;
+        };
+    }
+
     // Char Parsers
 
     template<typename U>
     auto Match(uchar value) -> ParserType(uchar, U)
     {
         typedef Result<uchar> Result;
-        return [value] (State<U> state) -> Result
+        auto id = FailureTracker::CharId(value);
+        return [value, id] (State<U> state) -> Result
         {
             uchar c;
             if (state.Stream.Next(&c) == 0u)
             {
+                NoteFailure(state, id);
                 return Result();
             }
             if (c != value)
             {
                 state.Stream.Back(1);
+                NoteFailure(state, id);
                 return Result();
             }
             return Result(c);
@@ -321,26 +634,34 @@ namespace TextSurvey
     auto Match(const string& value) -> ParserType(string, U)
     {
         typedef Result<string> Result;
-        return [value] (State<U> state) -> Result
+        ExpectedItem item(value, true);
+        return [item] (State<U> state) -> Result
         {
+            const uint blockSize = 16u;
+            auto& value = item.GetText();
             auto snapshot = state.Stream.GetSnapshot();
-            auto length = value.length();
-            vector<uchar> buffer(length);
+            auto length = (uint)value.length();
+            uchar buffer[blockSize];
 
-            auto readCount = state.Stream.Next(&buffer[0], length);
-            if (readCount != length)
+            for (auto offset = 0u; offset < length; offset += blockSize)
             {
-                snapshot.Restore();
-                return Result();
-            }
-
-            for (auto i = 0u; i < length; i++)
-            {
-                if (buffer[i] != value[i])
+                auto count = min(blockSize, length - offset);
+                auto readCount = state.Stream.Next(buffer, count);
+                if (readCount != count)
                 {
                     snapshot.Restore();
+                    NoteFailure(state, item);
                     return Result();
                 }
+                for (auto i = 0u; i < count; i++)
+                {
+                    if (buffer[i] != (uint8)value[offset + i])
+                    {
+                        snapshot.Restore();
+                        NoteFailure(state, item);
+                        return Result();
+                    }
+                }
             }
             return Result(value);
         };
@@ -355,11 +676,13 @@ namespace TextSurvey
             uchar c;
             if (state.Stream.Next(&c) == 0u)
             {
+                NoteFailure(state);
                 return Result();
             }
             if (!predicate(c))
             {
                 state.Stream.Back(1);
+                NoteFailure(state);
                 return Result();
             }
             return Result(c);
@@ -372,7 +695,9 @@ namespace TextSurvey
         uchar c;
         if (state.Stream.Next(&c, 1) != 1 || !(c >= '0' && c <= '9'))
         {
+            static const ExpectedItem digit("digit");
             state.Stream.Back(1);
+            NoteFailure(state, digit);
             return Result<uchar>();
         }
         return Result<uchar>(c);
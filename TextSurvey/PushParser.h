@@ -0,0 +1,187 @@
+#pragma once
+
+#include "Batch.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace TextSurvey
+{
+    enum struct FeedStatus
+    {
+        NeedMore,
+        Done,
+        Error
+    };
+
+    // Parses one message at a time from input that arrives in chunks. Each
+    // Feed resumes the grammar against everything received so far; a parse
+    // that fails or could still grow because it ran into the end of the
+    // received data reports NeedMore instead of an error.
+    //
+    // Combinators have no suspended frames to resume, so resuming means
+    // running the grammar again from the start of the message, whose bytes
+    // stay buffered until it completes. The session keeps checkpoints:
+    // Many, Split and Until pick up after the items they completed in the
+    // last run, and Memo results that did not reach the end are reused, so
+    // a resumed run only parses again what was still open at the end of the
+    // data. A message that is one long repetition costs close to one parse
+    // however many chunks it arrives in.
+    //
+    // After an Error the message stays put until Skip or SkipPast drops
+    // input to resynchronize on.
+    template<typename R, typename U, typename TStream = AsciiTextStream>
+    class PushParser
+    {
+    private:
+
+        Grammar<R, U> _grammar;
+        const U* _userState;
+        vector<uint8> _buffer;
+        ParseSession _session;
+        Result<R> _result;
+        uint _consumed;
+        FeedStatus _status;
+        Instrumentation* _probe;
+        uint64_t _skipped;
+        bool _skipping;
+        uint8 _delimiter;
+
+        auto Run(bool final) -> FeedStatus
+        {
+            auto length = (uint)_buffer.size();
+            TStream stream(_buffer.data(), length);
+            stream.SetInstrumentation(_probe);
+            State<U> state(stream, _userState, &_session);
+            _result = _grammar(state);
+            auto open = !final && stream.GetExtent() > length;
+            if (open)
+                _status = FeedStatus::NeedMore;
+            else if (_result.Code == ResultCode::Success)
+                _status = FeedStatus::Done;
+            else
+                _status = FeedStatus::Error;
+            _consumed = _status == FeedStatus::Done ? stream.GetOffset() : 0u;
+            return _status;
+        }
+
+        auto Restart() -> FeedStatus
+        {
+            _session.Clear();
+            _result = Result<R>();
+            _consumed = 0u;
+            _status = FeedStatus::NeedMore;
+            if (_buffer.empty())
+                return _status;
+            return Run(false);
+        }
+
+        void Drop(uint count)
+        {
+            _buffer.erase(_buffer.begin(), _buffer.begin() + count);
+            _skipped += count;
+        }
+
+        // Drops data up to and including the delimiter, or all of it while
+        // the delimiter has not arrived.
+        auto Resync() -> FeedStatus
+        {
+            auto found = find(_buffer.begin(), _buffer.end(), _delimiter);
+            if (found == _buffer.end())
+            {
+                Drop((uint)_buffer.size());
+                _status = FeedStatus::NeedMore;
+                return _status;
+            }
+            Drop((uint)(found - _buffer.begin()) + 1u);
+            _skipping = false;
+            return Restart();
+        }
+
+    public:
+
+        PushParser(const Grammar<R, U>& grammar, const U* userState = nullptr) :
+            _grammar(grammar), _userState(userState), _consumed(0u), _status(FeedStatus::NeedMore), _probe(nullptr),
+            _skipped(0u), _skipping(false), _delimiter(0u)
+        {
+            _session.SetCheckpoints(true);
+        }
+
+        // Data fed once the current message is complete (or has failed) is
+        // kept for the message Next starts.
+        auto Feed(const uint8* data, uint length) -> FeedStatus
+        {
+            auto offset = (uint)_buffer.size();
+            _buffer.insert(_buffer.end(), data, data + length);
+            if (_skipping)
+                return Resync();
+            if (_status != FeedStatus::NeedMore)
+                return _status;
+            _session.Apply(offset, 0u, length);
+            return Run(false);
+        }
+
+        // Signals that no more data will arrive for the current message.
+        auto Finish() -> FeedStatus
+        {
+            if (_status != FeedStatus::NeedMore)
+                return _status;
+            return Run(true);
+        }
+
+        inline auto GetStatus() const -> FeedStatus
+        {
+            return _status;
+        }
+
+        // Attaches probe to every run, so its callback fires as data arrives.
+        inline void SetInstrumentation(Instrumentation* probe)
+        {
+            _probe = probe;
+        }
+
+        inline auto GetResult() const -> const Result<R>&
+        {
+            return _result;
+        }
+
+        // Bytes of the buffered data taken by the completed message.
+        inline uint GetConsumed() const
+        {
+            return _consumed;
+        }
+
+        // Starts the next message with whatever followed the completed one.
+        auto Next() -> FeedStatus
+        {
+            _buffer.erase(_buffer.begin(), _buffer.begin() + _consumed);
+            return Restart();
+        }
+
+        // Drops count bytes from the start of the current message, usually
+        // one that failed, and starts over with what follows them.
+        auto Skip(uint count) -> FeedStatus
+        {
+            _skipping = false;
+            Drop(min(count, (uint)_buffer.size()));
+            return Restart();
+        }
+
+        // Drops the current message up to and including the next delimiter
+        // and starts over after it. Data fed before the delimiter arrives is
+        // dropped as well.
+        auto SkipPast(uint8 delimiter) -> FeedStatus
+        {
+            _skipping = true;
+            _delimiter = delimiter;
+            return Resync();
+        }
+
+        // Bytes dropped by Skip and SkipPast so far, for callers that track
+        // offsets in the whole input.
+        inline uint64_t GetSkipped() const
+        {
+            return _skipped;
+        }
+    };
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Common.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define TEXTSURVEY_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define TEXTSURVEY_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace TextSurvey
+{
+    namespace Simd
+    {
+        inline uint TrailingZeros(uint mask)
+        {
+            assert(mask != 0u);
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return (uint)index;
+#else
+            return (uint)__builtin_ctz(mask);
+#endif
+        }
+
+        inline uint TrailingZeros(uint64_t mask)
+        {
+            assert(mask != 0u);
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanForward64(&index, mask);
+            return (uint)index;
+#elif defined(_MSC_VER)
+            return (uint)mask != 0u ? TrailingZeros((uint)mask) : 32u + TrailingZeros((uint)(mask >> 32));
+#else
+            return (uint)__builtin_ctzll(mask);
+#endif
+        }
+
+        inline uint PopCount(uint mask)
+        {
+#if defined(_MSC_VER)
+            return (uint)__popcnt(mask);
+#else
+            return (uint)__builtin_popcount(mask);
+#endif
+        }
+
+        inline uint PopCount(uint64_t mask)
+        {
+            return PopCount((uint)mask) + PopCount((uint)(mask >> 32));
+        }
+
+        // Calls visitor(offset) for every byte equal to value in [begin, end).
+        template<typename F>
+        inline void FindEach(const uint8* data, uint begin, uint end, uint8 value, F visitor)
+        {
+            auto i = begin;
+#if defined(TEXTSURVEY_SSE2)
+            auto needle = _mm_set1_epi8((char)value);
+            for (; i + 16u <= end; i += 16u)
+            {
+                auto block = _mm_loadu_si128((const __m128i*)(data + i));
+                auto mask = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+                while (mask != 0u)
+                {
+                    visitor(i + TrailingZeros(mask));
+                    mask &= mask - 1u;
+                }
+            }
+#endif
+            for (; i < end; i++)
+                if (data[i] == value)
+                    visitor(i);
+        }
+
+        // Counts the bytes in [begin, end) that start a UTF-8 sequence.
+        inline uint CountUtf8Chars(const uint8* data, uint begin, uint end)
+        {
+            auto count = 0u;
+            auto i = begin;
+#if defined(TEXTSURVEY_SSE2)
+            auto high = _mm_set1_epi8((char)0xC0);
+            auto continuation = _mm_set1_epi8((char)0x80);
+            for (; i + 16u <= end; i += 16u)
+            {
+                auto block = _mm_and_si128(_mm_loadu_si128((const __m128i*)(data + i)), high);
+                auto mask = (uint)_mm_movemask_epi8(_mm_cmpeq_epi8(block, continuation));
+                count += 16u - PopCount(mask);
+            }
+#endif
+            for (; i < end; i++)
+                if ((data[i] & 0xC0) != 0x80)
+                    count++;
+            return count;
+        }
+    }
+}
@@ -35,7 +35,70 @@ namespace TextSurvey
     {
         return (range.Min == 0u || n >= range.Min) && (range.Max == 0u || n <= range.Max);
     }
+
+    inline bool AtMax(const Range range, const uint n)
+    {
+        return range.Max != 0u && n >= range.Max;
+    }
     
+    // A set of byte values.
+    class CharSet
+    {
+    private:
+
+        uint _bits[8];
+
+    public:
+
+        CharSet()
+        {
+            for (auto i = 0u; i < 8u; i++)
+                _bits[i] = 0u;
+        }
+
+        CharSet(const char* chars)
+        {
+            for (auto i = 0u; i < 8u; i++)
+                _bits[i] = 0u;
+            while (*chars != 0)
+                Add((uint8)*chars++);
+        }
+
+        static CharSet Between(const uint8 min, const uint8 max)
+        {
+            CharSet set;
+            for (auto c = (uint)min; c <= (uint)max; c++)
+                set.Add((uint8)c);
+            return set;
+        }
+
+        inline void Add(const uint8 c)
+        {
+            _bits[c >> 5] |= 1u << (c & 31u);
+        }
+
+        inline bool Contains(const uint8 c) const
+        {
+            return (_bits[c >> 5] & (1u << (c & 31u))) != 0u;
+        }
+
+        inline bool IsEmpty() const
+        {
+            for (auto i = 0u; i < 8u; i++)
+                if (_bits[i] != 0u)
+                    return false;
+            return true;
+        }
+
+        inline CharSet operator|(const CharSet& other) const
+        {
+            CharSet set;
+            for (auto i = 0u; i < 8u; i++)
+                set._bits[i] = _bits[i] | other._bits[i];
+            return set;
+        }
+    };
+
     template<typename T>
     class Option 
     {
@@ -52,13 +115,6 @@ namespace TextSurvey
 
         }
 
-        Option(T value) : 
-            _isSome(true), 
-            _value(value)
-        {
-
-        }
-
         Option(const T& value) : 
             _isSome(true), 
             _value(value)
@@ -73,31 +129,32 @@ namespace TextSurvey
 
         }
 
-        inline bool IsSome()
+        Option& operator=(const Option& other)
+        {
+            _isSome = other._isSome;
+            _value = other._value;
+            return *this;
+        }
+
+        inline bool IsSome() const
         {
             return _isSome;
         }
 
-        inline const T& GetValue()
+        inline const T& GetValue() const
         {
-            return T;
+            return _value;
         }
     };
 
     template<typename T>
-    inline const Option<T>& Some(T value)
-    {
-        return Option<T>(value);
-    }
-
-    template<typename T>
-    inline const Option<T>& Some(const T& value)
+    inline Option<T> Some(const T& value)
     {
         return Option<T>(value);
     }
 
     template<typename T>
-    inline const Option<T>& None()
+    inline Option<T> None()
     {
         return Option<T>();
     }
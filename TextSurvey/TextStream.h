@@ -1,5 +1,8 @@
 #pragma once
 
+#include "LineIndex.h"
+#include "Instrument.h"
+
 using namespace std;
 
 namespace TextSurvey
@@ -12,11 +15,35 @@ namespace TextSurvey
         const uint _length;
         uint _offset;
         uint _charOffset;
+        uint _extent;
+        LineIndex _lines;
+#if defined(TEXTSURVEY_INSTRUMENT)
+        Instrumentation* _probe;
+#endif
 
         TextStream(const uint8* data, uint length) :
-            _data(data), _length(length), _offset(0u), _charOffset(0u)
+            _data(data), _length(length), _offset(0u), _charOffset(0u), _extent(0u), _lines(data, length)
         {
+#if defined(TEXTSURVEY_INSTRUMENT)
+            _probe = nullptr;
+#endif
+        }
 
+        inline void Touch(uint offset)
+        {
+            if (offset > _extent)
+                _extent = offset;
+        }
+
+        virtual auto CountChars(uint begin, uint end) -> uint
+        {
+            return end - begin;
+        }
+
+        // Maps a stream offset to a byte offset in the source text.
+        virtual auto GetSourceOffset(uint offset) -> uint
+        {
+            return offset;
         }
 
     public:
@@ -26,6 +53,14 @@ namespace TextSurvey
 
             TextStream& _stream;
             uint _charOffset;
+#if defined(TEXTSURVEY_INSTRUMENT)
+            uint _offset;
+
+            inline uint GetReach() const
+            {
+                return _stream._offset > _offset ? _stream._offset - _offset : 0u;
+            }
+#endif
 
         public:
 
@@ -33,14 +68,40 @@ namespace TextSurvey
                 _stream(stream), 
                 _charOffset(stream._charOffset)
             {
+#if defined(TEXTSURVEY_INSTRUMENT)
+                _offset = stream._offset;
+                if (_stream._probe != nullptr)
+                    _stream._probe->OnSnapshot();
+#endif
+            }
+
+#if defined(TEXTSURVEY_INSTRUMENT)
+            Snapshot(const Snapshot& other) :
+                _stream(other._stream),
+                _charOffset(other._charOffset),
+                _offset(other._offset)
+            {
+                if (_stream._probe != nullptr)
+                    _stream._probe->OnSnapshot();
+            }
 
+            ~Snapshot()
+            {
+                if (_stream._probe != nullptr)
+                    _stream._probe->OnSnapshotEnd(GetReach());
             }
+#endif
 
             void Restore()
             {
+#if defined(TEXTSURVEY_INSTRUMENT)
+                if (_stream._probe != nullptr)
+                    _stream._probe->OnSnapshotReach(GetReach());
+#endif
                 uint diff = _stream._charOffset - _charOffset;
                 uint result = _stream.Back(diff);                
                 assert(result == diff);
+                (void)result;
             }
         };
 
@@ -51,7 +112,43 @@ namespace TextSurvey
             return Snapshot(r);
         }
 
-        inline uint GetLength()
+        // Reports this stream's Snapshots and Named rules to probe. Does
+        // nothing unless TEXTSURVEY_INSTRUMENT is defined.
+        inline void SetInstrumentation(Instrumentation* probe)
+        {
+#if defined(TEXTSURVEY_INSTRUMENT)
+            _probe = probe;
+            if (probe != nullptr)
+                probe->Attach();
+#else
+            (void)probe;
+#endif
+        }
+
+        inline Instrumentation* GetInstrumentation()
+        {
+#if defined(TEXTSURVEY_INSTRUMENT)
+            return _probe;
+#else
+            return nullptr;
+#endif
+        }
+
+        // The text the stream reads and its length in bytes, for readers that
+        // scan the bytes themselves.
+        inline const uint8* GetData()
+        {
+            return _data;
+        }
+
+        virtual auto GetLength() -> uint
+        {
+            return _length;
+        }
+
+        // One past the last offset. Offsets count bytes, so this is
+        // GetLength() except where a stream counts other units.
+        inline uint GetEnd()
         {
             return _length;
         }
@@ -66,6 +163,41 @@ namespace TextSurvey
             return _charOffset;
         }  
 
+        // One past the farthest byte examined, or GetLength() + 1 once a
+        // read has run into the end of the data.
+        inline uint GetExtent()
+        {
+            return _extent;
+        }
+
+        inline void SetExtent(uint extent)
+        {
+            _extent = extent;
+        }
+
+        // Moves forward to a position already known to be a char boundary.
+        inline void Seek(uint offset, uint charOffset)
+        {
+            assert(offset >= _offset && offset <= _length);
+            _offset = offset;
+            _charOffset = charOffset;
+            Touch(offset);
+        }
+
+        inline Position GetPosition()
+        {
+            return GetPosition(_offset);
+        }
+
+        // Offsets past the end give the position at the end.
+        auto GetPosition(uint offset) -> Position
+        {
+            offset = GetSourceOffset(min(offset, _length));
+            auto line = _lines.GetLine(offset);
+            auto lineStart = _lines.GetLineStart(line);
+            return Position(line + 1u, CountChars(lineStart, offset) + 1u);
+        }
+
         inline uint Next(uchar* buffer)
         {
             return Next(buffer, 1);
@@ -90,10 +222,13 @@ namespace TextSurvey
             auto result = _length - _offset;
             if (result > count)
                 result = count;
+            else if (result < count)
+                Touch(_length + 1u);
             for (auto i = 0ul; i < result; i++) 
                 *(buffer + i) = _data[(unsigned int)(_offset + i)];
             _offset += result;
             _charOffset = _offset;
+            Touch(_offset);
             return result;
         }
 
@@ -109,6 +244,13 @@ namespace TextSurvey
 
     class Utf8TextStream : public TextStream
     {
+    protected:
+
+        auto CountChars(uint begin, uint end) -> uint
+        {
+            return Simd::CountUtf8Chars(_data, begin, end);
+        }
+
     public:
         Utf8TextStream(const uint8* data, uint length) :
             TextStream(data, length)
@@ -122,12 +264,12 @@ namespace TextSurvey
             auto charOffset = 0;
             auto p = buffer;
 
-            for (auto i = 0ul; i < count && _offset < _length; i++, charOffset++, p++) 
+            for (auto i = 0ul; i < count && offset < _length; i++, charOffset++, p++) 
             {
                 *p = 0;
 
                 uint count = 0;
-                while ((_data[offset] & 0xC0) == 0x80)
+                while (offset + 1u < _length && (_data[offset] & 0xC0) == 0x80)
                     *p += ((uint)_data[offset++] & (uint)0x3F) << (uint)(6 * count++);
 
                 if ((_data[offset] & 0xF8) == 0xF0)
@@ -140,8 +282,11 @@ namespace TextSurvey
                     *p += (uint)_data[offset++]; 
             }
 
+            if ((uint)charOffset < count)
+                Touch(_length + 1u);
             _offset = offset;
             _charOffset += charOffset;
+            Touch(_offset);
             return charOffset;
         }
 
@@ -149,14 +294,12 @@ namespace TextSurvey
         {
             if (count > _charOffset)
                 count = _charOffset;
-            uint offset = _offset - 1;
+            uint offset = _offset;
             for (uint i = 0; i < count; i++)
             {
-                if ((_data[offset] & 0x80) == 0)
-                {
-                    continue;
-                }
-                while ((_data[--offset] & 0xC0) == 0x80);
+                offset--;
+                while (offset > 0 && (_data[offset - 1] & 0xC0) == 0x80)
+                    offset--;
             }
             _charOffset -= count;
             _offset = offset;
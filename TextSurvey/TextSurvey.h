@@ -2,4 +2,6 @@
 
 #include "Support.h"
 #include "Parsers.h"
-#include "TextStream.h"
\ No newline at end of file
+#include "TextStream.h"
+#include "Batch.h"
+#include "PushParser.h"
\ No newline at end of file